@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <iosfwd>
+#include <string>
+
+#include "board.h"
+#include "nnue.h"
+#include "search.h"
+
+namespace morphy {
+
+struct AnalysisConfig {
+    int workerCount;                // 0 uses every core
+    SearchLimits limits;            // per position
+    size_t hashSize;                // transposition table MB per worker
+    const nnue::Network* network;   // shared by the workers, null for the classical eval
+};
+
+const static AnalysisConfig DEFAULT_ANALYSIS_CONFIG {
+    0,                  // worker count
+    {10, 0, 0, 0},      // limits, depth 10
+    DEFAULT_HASH_SIZE,  // hash size
+    nullptr             // network
+};
+
+struct AnalysisResult {
+    size_t line;            // input line, from 1
+    std::string fen;        // the line as read
+    std::string id;         // EPD id operation, if any
+    std::string error;      // set when the position couldn't be read
+    bool white;             // side to move
+    Move bestMove;
+    MoveGenState search;
+};
+
+// One JSON object on a single line, without the newline. Scores are
+// from the side to move's point of view, moves in long algebraic
+// notation.
+std::string resultToJSON (const AnalysisResult& result);
+
+// Reads one FEN or EPD position per line from in and searches each to
+// config.limits on config.workerCount threads. Every worker has its own
+// Engine and transposition table, cleared for each position so results
+// don't depend on scheduling. Results are written to out as JSON lines
+// in input order while later positions are still being searched. Blank
+// lines and lines starting with # are skipped. Returns the number of
+// positions written, errors included.
+size_t analyzePositions (std::istream& in, std::ostream& out, const AnalysisConfig& config);
+
+} // end namespace
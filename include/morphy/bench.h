@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <iosfwd>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "engine.h"
+
+namespace morphy {
+
+struct BenchConfig {
+    int depth;
+    int threadCount;
+    size_t hashSize;        // transposition table MB
+};
+
+const static BenchConfig DEFAULT_BENCH_CONFIG {
+    10,                     // depth
+    1,                      // thread count
+    DEFAULT_HASH_SIZE       // hash size
+};
+
+struct BenchResult {
+    size_t positions;
+    uint64_t nodes;
+    uint64_t time;          // ms
+    uint64_t nps;
+};
+
+// Searches the built-in positions to bench.depth, each from an empty
+// transposition table, and writes a line per position and the totals to
+// out. engine supplies everything else about the search, the network
+// included. With one thread the node total only changes when the search
+// does, so it doubles as a signature of the search's behaviour.
+BenchResult runBench (const BenchConfig& bench, const EngineConfig& engine, std::ostream& out);
+
+// The FENs runBench searches, a mix of openings, middlegames and
+// endgames that the microbenchmarks reuse as their corpus.
+std::span<const char* const> benchPositions ();
+
+// bench [hash] [threads] [depth], anything left out keeps its value in
+// config. False if an argument isn't a positive number.
+bool parseBench (const std::vector<std::string>& message, BenchConfig& config);
+
+} // end namespace
@@ -1,13 +1,20 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <vector>
+#include <string>
+#include <iosfwd>
 #include <array>
 #include <initializer_list>
+#include <utility>
 
 
 namespace morphy {
 
+const size_t MAX_MOVES = 256;
+const size_t MAX_PIECES = 16;
+
 const uint8_t NO_CASTLE = 0;
 const uint8_t CASTLE_KINGSIDE = 1 << 0;
 const uint8_t CASTLE_QUEENSIDE = 1 << 2;
@@ -56,14 +63,75 @@ struct Move {
     PieceType type;
     uint16_t from;
     uint16_t to;
+    PieceType promotion = PieceType::NONE;
 
     Move () {}
 
     Move (PieceType type, uint16_t from, uint16_t to) :
         type(type), from(from), to(to)
     {}
+
+    Move (PieceType type, uint16_t from, uint16_t to, PieceType promotion) :
+        type(type), from(from), to(to), promotion(promotion)
+    {}
+};
+
+// Compact move used for move lists. Bits 0-5 are the from square,
+// 6-11 the to square and 12-15 the MoveFlag. The moving piece isn't
+// stored, unpackMove recovers it from the board.
+// https://www.chessprogramming.org/Encoding_Moves#From-To_Based
+enum MoveFlag : uint16_t {
+    QUIET = 0,
+    DOUBLE_PUSH = 1,
+    KING_CASTLE = 2,
+    QUEEN_CASTLE = 3,
+    CAPTURE = 4,
+    EN_PASSANT = 5,
+    PROMOTION = 8,          // low two bits select knight, bishop, rook, queen
+    PROMOTION_CAPTURE = 12
+};
+
+struct PackedMove {
+    uint16_t data;
+
+    constexpr PackedMove () : data(0) {}
+    constexpr PackedMove (uint16_t from, uint16_t to, uint16_t flags) :
+        data(from | (to << 6) | (flags << 12))
+    {}
+
+    constexpr uint16_t from () const { return data & 0x3f; }
+    constexpr uint16_t to () const { return (data >> 6) & 0x3f; }
+    constexpr uint16_t flags () const { return data >> 12; }
+    constexpr bool isCapture () const { return flags() & CAPTURE; }
+    constexpr bool isPromotion () const { return flags() & PROMOTION; }
+    constexpr bool operator== (const PackedMove& other) const { return data == other.data; }
+};
+
+// Fixed capacity list used during move generation so generating and
+// validating moves never touches the heap. Capacity isn't checked on push.
+template <class T, size_t N>
+struct FixedList {
+    std::array<T,N> items;
+    size_t count = 0;
+
+    void push_back (const T& value) { items[count++] = value; }
+    template <class... Args>
+    T& emplace_back (Args&&... args) { return items[count++] = T(std::forward<Args>(args)...); }
+    void clear () { count = 0; }
+    size_t size () const { return count; }
+    constexpr size_t capacity () const { return N; }
+    bool empty () const { return count == 0; }
+    T& operator[] (size_t idx) { return items[idx]; }
+    const T& operator[] (size_t idx) const { return items[idx]; }
+    T* begin () { return items.data(); }
+    T* end () { return items.data() + count; }
+    const T* begin () const { return items.data(); }
+    const T* end () const { return items.data() + count; }
 };
 
+using MoveList = FixedList<PackedMove, MAX_MOVES>;
+using ThreatList = FixedList<Move, MAX_PIECES * 4>;
+
 struct MaskIterator {
     uint64_t mask;
     bool hasBits () const;
@@ -101,6 +169,30 @@ struct Board {
     bool is_white = true;
     bool promotion_needed = false;
     uint16_t promotion_sq = 0;
+    // Plies since the last capture or pawn move, and the FEN move number
+    uint16_t halfmove_clock = 0;
+    uint16_t fullmove_number = 1;
+    // Zobrist keys, updated incrementally by setPiece, clearPiece,
+    // applyMove and flipBoard. pawn_hash only covers pawns.
+    uint64_t hash = 0;
+    uint64_t pawn_hash = 0;
+    // Material and piece-square sums from white's side for the middle
+    // and endgame, and the game phase (see eval.h). Kept up to date by
+    // setPiece and clearPiece.
+    int32_t psq_mg = 0;
+    int32_t psq_eg = 0;
+    int32_t phase = 0;
+};
+
+// Everything makeMove changes that can't be recovered from the move itself.
+struct UndoRecord {
+    PieceType captured;
+    uint32_t en_passant_sq;
+    uint8_t current_castle_flags;
+    uint8_t other_castle_flags;
+    uint16_t halfmove_clock;
+    uint64_t hash;
+    uint64_t pawn_hash;
 };
 
 // Struct for caching calculated attribs
@@ -110,8 +202,22 @@ struct MoveGenCache {
     uint64_t allPieces;
     uint64_t enemyPieces;
     uint64_t moveCount;
-    std::vector<MoveIterator> moves;
-    std::vector<MaskIterator> kingThreats;
+    uint16_t kingSq;
+    uint64_t checkers;  // enemy pieces giving check
+    uint64_t pinned;    // own pieces pinned to the king
+    // Pawn moves are generated for all pawns at once. Each set holds
+    // target squares, the from square is the target less the set's offset.
+    uint64_t pawnPushes = 0;        // from to - 8
+    uint64_t pawnDoublePushes = 0;  // from to - 16
+    uint64_t pawnCapturesWest = 0;  // from to - 7
+    uint64_t pawnCapturesEast = 0;  // from to - 9
+    uint64_t pawnEnPassant = 0;     // from squares, the target is Board::en_passant_sq
+    // Every other piece has its own mask
+    FixedList<MoveIterator, MAX_PIECES> moves;
+    // Squares the enemy attacks, with sliders seeing through our king so
+    // it can't step back along a checking ray. Any king move or castling
+    // square in here is illegal.
+    uint64_t kingThreats;
 
     MoveGenCache () {}
     MoveGenCache (const Board& board);
@@ -121,7 +227,7 @@ struct MoveGenState {
     size_t searchTime;
     size_t depth;
     size_t nodes;
-    size_t score;
+    int score;
     size_t moveNumber;
     Move currentMove;
     std::vector<Move> bestPath;
@@ -136,6 +242,11 @@ void setBoardColor (Board& board, bool white);
 void setPiece (Board& board, PieceType type, const Vec2& pos);
 void clearPiece (Board& board, PieceType type, const Vec2& pos) ;
 
+// From-scratch key computation, for initialisation and validating
+// the incrementally updated Board::hash and Board::pawn_hash.
+uint64_t zobristHash (const Board& board);
+uint64_t zobristPawnHash (const Board& board);
+
 uint64_t all_pieces (const Board& board);
 uint64_t enemy_pieces (const Board& board);
 
@@ -151,14 +262,52 @@ uint64_t getPieceBoard (const Board& board, uint64_t mask, PieceType type);
 
 MoveIterator generateMoveMask (MoveGenCache& genState, const Board& state, const Vec2& pos, PieceType type);
 void generateAllMoves (MoveGenCache& genState, const Board& state);
+// Only legal moves: pinned pieces stay on their pin ray, checks must be
+// evaded, and the king never steps onto an attacked square.
 void generateAllLegalMoves (MoveGenCache& genState, const Board& state);
-
-std::vector<Move> threatsToCells (const MoveGenCache& genState, const Board& board, const std::initializer_list<Vec2>& positions);
-std::vector<Move> threatsToCell (const MoveGenCache& genState, const Board& board, const Vec2& pos);
+// The legal captures (en passant included) and promotions, for the
+// quiescence search. moveCount counts every promotion piece.
+void generateAllCaptures (MoveGenCache& genState, const Board& state);
+// The rest of the legal moves: non-capturing moves that don't promote,
+// castling included.
+void generateAllQuiets (MoveGenCache& genState, const Board& state);
+
+// Expands the pawn sets and the per-piece masks in genState.moves into
+// packed moves, one per promotion piece for promotions.
+void serializeMoves (const MoveGenCache& genState, const Board& state, MoveList& list);
+PackedMove packMove (const Board& state, const Move& move);
+Move unpackMove (const Board& state, PackedMove move);
+
+// Pieces of both sides attacking sq when the board has the given
+// occupancy. Removing pieces from occupied reveals the sliders behind
+// them, which is what static exchange evaluation needs.
+uint64_t attackersTo (const Board& board, uint16_t sq, uint64_t occupied);
+// Whether an enemy piece in occupied attacks sq. Stops at the first
+// attacker, cheapest pieces first.
+bool isSquareAttacked (const Board& board, uint16_t sq, uint64_t occupied);
+// Every square attacked by an enemy piece given the occupancy.
+uint64_t attackedSquares (const Board& board, uint64_t occupied);
+
+// Enemy pieces attacking each of positions, as moves from the attacker
+// onto the cell. Cells that might not fit in the list are left out.
+ThreatList threatsToCells (const MoveGenCache& genState, const Board& board, const std::initializer_list<Vec2>& positions);
+ThreatList threatsToCell (const MoveGenCache& genState, const Board& board, const Vec2& pos);
 
 bool validateMove (const MoveGenCache& genState, const Board& state, const Move& move);
 void applyMove (Board& state, const Move& move);
 
+// applyMove followed by flipBoard, so the opponent becomes the current side.
+// Fills undo with what unmakeMove needs to restore the position in place.
+void makeMove (Board& state, const Move& move, UndoRecord& undo);
+void unmakeMove (Board& state, const Move& move, const UndoRecord& undo);
+// Passes the move to the opponent, for null move pruning.
+void makeNullMove (Board& state, UndoRecord& undo);
+void unmakeNullMove (Board& state, const UndoRecord& undo);
+
+// Boards are stored relative to the side to move. Converts between
+// relative and absolute (white's) square indices; it is its own inverse.
+inline uint16_t relativeSquare (bool white, uint16_t sq) { return white ? sq : sq ^ 56; }
+
 void printBoard (Board board, std::ostream& out);
 std::string boardToFEN (const Board& board);
 bool boardFromFEN (Board& board, const std::string& fen);
@@ -3,23 +3,42 @@
 
 #include <stdint.h>
 #include <vector>
-#include <stack>
 #include <atomic>
 #include <thread>
+#include <mutex>
 #include <iostream>
 #include <string>
+#include <functional>
+#include <memory>
 
 #include "board.h"
 #include "uci.h"
+#include "tt.h"
+#include "nnue.h"
 
 namespace morphy {
 
+struct SearchLimits;
+struct ThreadTables;
+
+// Called by the search after every completed iteration.
+using SearchCallback = std::function<void (const MoveGenState&)>;
 
 struct EngineConfig {
     RuleSet ruleset;
     int searchDepth;
     int theadCount;
+    size_t hashSize;        // transposition table MB
     std::array<int,6> piece_values;
+    // Search selectivity, each can be switched off on its own
+    bool nullMovePruning;
+    bool lateMoveReductions;
+    bool reverseFutilityPruning;
+    bool futilityPruning;
+    bool aspirationWindows;
+    // Evaluates with this network when set, otherwise the tapered
+    // piece-square eval. Owned by whoever set it.
+    const nnue::Network* network;
     int pieceValue (PieceType type) const;
 };
 
@@ -27,7 +46,14 @@ const static EngineConfig DEFAULT_ENGINE_CONFIG {
     RuleSet::STANDARD,      // ruleset
     100,                    // search depth
     1,                      // thread count
-    {{100,300,300,500,900}} // piece_values
+    DEFAULT_HASH_SIZE,      // hash size
+    {{100,500,300,300,900,0}}, // piece_values, in PieceType order
+    true,                   // null move pruning
+    true,                   // late move reductions
+    true,                   // reverse futility pruning
+    true,                   // futility pruning
+    true,                   // aspiration windows
+    nullptr                 // network
 };
 
 
@@ -35,53 +61,89 @@ const static EngineConfig DEFAULT_ENGINE_CONFIG {
 class Engine {
 private:
     // TODO: While this isn't necessary for UCI it is necesasry for other protocols.
-    std::stack<Board> _states;
-    MoveGenCache _genState;
+    Board _board;
+    std::vector<std::pair<Move,UndoRecord>> _history;
+    MoveGenState _lastSearch;
+    TranspositionTable _tt;
+    // Move ordering and pawn hash of each search thread, kept between moves
+    std::vector<std::unique_ptr<ThreadTables>> _threadTables;
+    std::atomic<bool> _stop{false};
+    nnue::Network _network;
+    bool _useNetwork = false;
 
     void clearState ();
+    void updateEvaluator ();
 
 public:
     EngineConfig config;
 
-    Engine () :
-        config(DEFAULT_ENGINE_CONFIG)
-    {
-        restart();
-    }
-
-    Engine (const EngineConfig& config) :
-        config(config)
-    {
-        restart();
-    }
+    Engine ();
+    Engine (const EngineConfig& config);
+    ~Engine ();
 
     void restart ();
+    void newGame ();
+    // False if the table can't be allocated, the current one is kept.
+    bool setHashSize (size_t megabytes);
+    void setThreadCount (int count);
+    // Replaces the network with the one in path. The current one is kept
+    // if the file can't be loaded.
+    bool loadNetwork (const std::string& path, std::string& error);
+    // The network is only used once one has been loaded.
+    void setUseNetwork (bool enabled);
+    bool usingNetwork () const;
+    // Asks a running search to return its best move so far. The request
+    // stays set, searches started later return at once until clearStop.
+    void stop ();
+    void clearStop ();
+    bool stopRequested () const;
     void setBoard (const Board& board);
     std::vector<Move> getAvailableMoves ();
     std::vector<Move> getAvailableMoves (PieceType type, int pos);
     void undoMove ();
     void makeMove (const Move& move);
     Move makeMove ();
+    Move makeMove (const SearchLimits& limits, const SearchCallback& onIteration = nullptr);
+    Move findBestMove (const SearchLimits& limits, const SearchCallback& onIteration = nullptr);
+    const MoveGenState& lastSearch () const;
     Board& getState ();
 };
 
+// Searches run on a worker thread owned by the adaptor so stop, isready
+// and quit are handled while the engine is thinking. Output from both
+// threads goes through _ioLock.
 class UCIAdaptor {
 private:
     Engine& _engine;
     uci::IOPipe& _io;
     bool _isRunning;
+    std::thread _searchThread;
+    std::mutex _ioLock;
+
+    void startSearch (const std::vector<std::string>& message);
+    void stopSearch ();
 
 public:
 
     UCIAdaptor (Engine& engine, uci::IOPipe& pipe);
+    ~UCIAdaptor ();
     void handleUCIMessage (const std::vector<std::string>& message);
+    // Blocks until the current search, if any, has sent its bestmove.
+    void waitForSearch ();
     bool isRunning ();
 };
 
 
-Move findBestMove (const EngineConfig& config, MoveGenCache& genState, const Board& state);
+// classicalEval of state. config isn't used, the eval has its own
+// tapered material values, so piece_values only affect scorePieces,
+// staticExchange and capture ordering.
 int scoreBoard (const EngineConfig& config, const Board& state);
 int scorePieces (const EngineConfig& config, const Board& state, uint64_t mask);
+// Static exchange evaluation: the material the side to move wins (or
+// loses, when negative) if both sides keep recapturing on move.to with
+// their least valuable attacker. Pins are ignored.
+// https://www.chessprogramming.org/Static_Exchange_Evaluation
+int staticExchange (const EngineConfig& config, const Board& state, const Move& move);
 
 } // end namespace
 
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <vector>
+#include "board.h"
+
+namespace morphy {
+
+// Game phase from the pieces left on the board, PHASE_MAX with all
+// minor and major pieces, 0 with only kings and pawns.
+const int PHASE_MAX = 24;
+constexpr std::array<int,6> phase_weight {{0, 2, 1, 1, 4, 0}};   // PieceType order
+
+using PieceSquareTable = std::array<std::array<int16_t,64>,6>;
+
+// Material plus piece-square bonus for a white piece on an absolute
+// square, for the middlegame and the endgame. Black uses the square
+// mirrored vertically.
+// https://www.chessprogramming.org/Tapered_Eval
+extern const PieceSquareTable pst_mg;
+extern const PieceSquareTable pst_eg;
+
+// Recomputes the incrementally kept psq_mg, psq_eg and phase of board
+// from its bitboards.
+void refreshPieceSquare (Board& board);
+
+const size_t DEFAULT_PAWN_TABLE_SIZE = 1 << 15;    // entries, a power of two
+
+// Pawn structure terms from white's side. Passed, isolated, doubled and
+// backward pawns only depend on the pawns, the king shield also depends
+// on where the kings stand and is redone when they move.
+struct PawnEntry {
+    uint64_t key = 0;               // Board::pawn_hash
+    int16_t mg = 0;
+    int16_t eg = 0;
+    std::array<uint16_t,2> kingSq{{64, 64}};    // absolute, white then black
+    std::array<int16_t,2> shield{{0, 0}};       // middlegame only
+};
+
+void evaluatePawns (const Board& board, PawnEntry& entry);
+void evaluateShield (const Board& board, PawnEntry& entry);
+
+// Cache of PawnEntry keyed on Board::pawn_hash. Not thread safe, each
+// search thread has its own.
+class PawnTable {
+private:
+    std::vector<PawnEntry> _entries;
+
+public:
+    // Counted by probe, for tuning the table size
+    uint64_t probes = 0;
+    uint64_t hits = 0;
+
+    PawnTable (size_t count = DEFAULT_PAWN_TABLE_SIZE);
+    void clear ();
+    // The entry for board with its shield up to date
+    const PawnEntry& probe (const Board& board);
+};
+
+// Piece-square sums plus the pawn structure, middlegame and endgame
+// interpolated by phase, from the side to move's point of view. The
+// second form computes the pawn terms without a cache.
+int classicalEval (const Board& board, PawnTable& pawns);
+int classicalEval (const Board& board);
+
+} // end namespace
@@ -1,11 +1,38 @@
 #pragma once
 
+#include <stddef.h>
 #include <string>
+#include <string_view>
 #include "board.h"
 
 namespace morphy {
 namespace fen {
 
-bool fen_to_board (morphy::Board& board, const std::string& fen);
+// Longest FEN board_to_fen writes
+const size_t MAX_FEN_LENGTH = 93;
+
+// Outcome of fen_to_board. error is a static message, null on success.
+// offset is where parsing stopped, or where the error was found.
+struct ParseResult {
+    const char* error = nullptr;
+    size_t offset = 0;
+
+    explicit operator bool () const { return error == nullptr; }
+};
+
+// Reads the placement, side to move, castling and en passant fields,
+// then the halfmove clock and fullmove number when present. Anything
+// else after the fourth field is left alone so EPD operations can
+// follow, offset then points at them.
+//
+// Castling rights without the king and rook at home are dropped, and
+// so is an en passant square no pawn can capture on, the way applyMove
+// records them, so equal positions get equal hashes.
+ParseResult fen_to_board (morphy::Board& board, std::string_view fen);
+
+// Writes all six fields to out, which must hold MAX_FEN_LENGTH chars.
+// Returns the length, out isn't null terminated.
+size_t board_to_fen (const morphy::Board& board, char* out);
+std::string board_to_fen (const morphy::Board& board);
 
 }} // end namespaces
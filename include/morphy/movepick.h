@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include "board.h"
+#include "engine.h"
+
+namespace morphy {
+
+const int MAX_KILLER_PLY = 128;
+const int HISTORY_MAX = 16384;
+
+// Per thread move ordering statistics, filled in from beta cutoffs.
+// Boards are relative to the side to move, so quiet move history is
+// kept separately for each colour.
+struct OrderingTables {
+    std::array<std::array<PackedMove,2>,MAX_KILLER_PLY> killers;
+    std::array<std::array<PackedMove,64>,6> counters;   // [prev type][prev to]
+    std::array<std::array<std::array<int16_t,64>,64>,2> history;    // [white][from][to]
+
+    OrderingTables () { clear(); }
+
+    void clear ();
+    // Killers are by ply from the root, so they don't carry over to the
+    // next search. History and countermoves do.
+    void clearKillers ();
+    int historyScore (bool white, PackedMove move) const;
+    // A quiet move caused a cutoff after the quiets in tried failed to.
+    void updateQuiet (const Board& board, const Move& prevMove, int ply, int depth,
+                      PackedMove move, const PackedMove* tried, size_t triedCount);
+};
+
+// Hands out the legal moves of a position one at a time, best guess
+// first. Captures and quiet moves are only generated once the stages
+// before them failed to produce a cutoff.
+// https://www.chessprogramming.org/Move_Ordering
+class MovePicker {
+public:
+    enum Stage {
+        TT_MOVE, GEN_CAPTURES, GOOD_CAPTURES, KILLER_1, KILLER_2, COUNTER_MOVE,
+        GEN_QUIETS, QUIETS, BAD_CAPTURES, DONE
+    };
+
+private:
+    const EngineConfig& _config;
+    const Board& _board;
+    MoveGenCache& _genState;
+    const OrderingTables& _tables;
+    int _ply;
+    bool _capturesOnly;
+    Stage _stage;
+
+    PackedMove _ttMove;
+    std::array<PackedMove,3> _refutations;  // killers and countermove
+
+    MoveList _moves;
+    std::array<int,MAX_MOVES> _scores;
+    size_t _current = 0;
+    MoveList _badCaptures;
+    size_t _badCurrent = 0;
+
+    bool usable (PackedMove move, bool quiet) const;
+    bool isRefutation (PackedMove move) const;
+    size_t pickBest ();
+
+public:
+    // capturesOnly is for the quiescence search: only good captures and
+    // promotions are returned, unless the side to move is in check.
+    MovePicker (const EngineConfig& config, const Board& board, MoveGenCache& genState,
+                const OrderingTables& tables, int ply, PackedMove ttMove, bool capturesOnly = false);
+
+    bool next (PackedMove& packed, Move& move);
+    Stage stage () const { return _stage; }
+};
+
+} // end namespace
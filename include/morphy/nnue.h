@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <string>
+#include <vector>
+#include "board.h"
+
+namespace morphy {
+namespace nnue {
+
+// One input per (colour relative to the perspective, piece type, square
+// seen from the perspective), so both perspectives share the weights.
+// https://www.chessprogramming.org/NNUE
+const int FEATURE_COUNT = 2 * 6 * 64;
+const int MAX_HIDDEN = 512;
+const int HIDDEN_ALIGN = 16;    // hidden sizes are a multiple of this
+
+// Quantisation: accumulators are clipped to [0, QA], output weights are
+// scaled by QB and the result maps to centipawns by OUTPUT_SCALE.
+const int QA = 255;
+const int QB = 64;
+const int OUTPUT_SCALE = 400;
+
+// Weight file layout, all little endian:
+//   char[4]  "MNUE"
+//   uint32   version (1)
+//   uint32   hidden size
+//   int16    feature weights [FEATURE_COUNT][hidden]
+//   int16    feature biases [hidden]
+//   int16    output weights [2 * hidden], side to move's half first
+//   int32    output bias
+const uint32_t FILE_VERSION = 1;
+
+struct Network {
+    int hidden = 0;
+    std::vector<int16_t> featureWeights;
+    std::vector<int16_t> featureBias;
+    std::vector<int16_t> outputWeights;
+    int32_t outputBias = 0;
+
+    bool loaded () const { return hidden > 0; }
+};
+
+// First layer outputs for the white and black perspectives. Only the
+// first Network::hidden values of each are used.
+struct Accumulator {
+    alignas(32) std::array<std::array<int16_t,MAX_HIDDEN>,2> values;
+};
+
+// Reads a weight file into net. On failure net is left untouched and
+// error says why.
+bool loadNetwork (Network& net, const std::string& path, std::string& error);
+
+// Builds acc from scratch for every piece on board.
+void refresh (const Network& net, const Board& board, Accumulator& acc);
+// dst becomes src with move applied, board is the position before the
+// move. Only the features the move touches are added or removed.
+void update (const Network& net, const Board& board, const Move& move,
+             const Accumulator& src, Accumulator& dst);
+// Centipawns from the side to move's point of view.
+int evaluate (const Network& net, const Board& board, const Accumulator& acc);
+
+// The accumulator and output kernels are picked at startup from what
+// the CPU supports. setSimd falls back to the best supported level at
+// or below the one asked for, and must not be called during a search.
+enum class Simd {
+    SCALAR, SSE41, AVX2
+};
+
+Simd detectSimd ();
+Simd activeSimd ();
+void setSimd (Simd simd);
+const char* simdName (Simd simd);
+
+}} // end namespaces
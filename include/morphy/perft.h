@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <iosfwd>
+#include "board.h"
+
+namespace morphy {
+
+// Counts the leaf nodes of the legal move tree. The last ply is bulk
+// counted from the legal move masks instead of being played out.
+uint64_t perft (Board& board, int depth);
+
+// perft, printing the node count under each root move.
+uint64_t perftDivide (Board& board, int depth, std::ostream& out);
+
+struct PerftConfig {
+    int threadCount;
+    size_t hashSize;    // MB shared between threads, 0 disables the table
+};
+
+const static PerftConfig DEFAULT_PERFT_CONFIG {
+    1,      // thread count
+    16      // hash size
+};
+
+// The same counts, with the first two plies split into tasks that
+// config.threadCount workers pull from a shared queue. Subtree counts
+// are cached in a lock-free table shared by all workers.
+uint64_t perft (Board& board, int depth, const PerftConfig& config);
+uint64_t perftDivide (Board& board, int depth, const PerftConfig& config, std::ostream& out);
+
+// Runs perft on the standard reference positions up to maxDepth and
+// compares against their known node counts. Prints nodes per second.
+bool runPerftSuite (int maxDepth, const PerftConfig& config, std::ostream& out);
+
+} // end namespace
@@ -0,0 +1,11 @@
+#pragma once
+
+namespace morphy {
+
+// Search scores that the protocol code also has to decode, kept apart
+// so it doesn't depend on the search.
+const int MAX_PLY = 128;
+const int SCORE_MATE = 31000;       // mate in n plies scores SCORE_MATE - n
+const int SCORE_MATE_BOUND = SCORE_MATE - MAX_PLY;
+
+} // end namespace
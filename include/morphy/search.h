@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "board.h"
+#include "engine.h"
+#include "eval.h"
+#include "movepick.h"
+#include "score.h"
+#include "tt.h"
+
+namespace morphy {
+
+const int SCORE_INFINITE = 32000;
+const int SCORE_NONE = -SCORE_INFINITE;   // no static eval stored
+const uint64_t DEFAULT_MOVE_TIME = 1000;
+const int MAX_THREADS = 256;
+
+struct SearchLimits {
+    int depth;
+    uint64_t nodes;     // 0 is unlimited
+    uint64_t softTime;  // ms, no new iteration is started after this, 0 is unlimited
+    uint64_t hardTime;  // ms, the search is aborted after this, 0 is unlimited
+};
+
+// Tables a search thread leaves for the next search, so move ordering and
+// the pawn hash don't start cold on every move. Cleared on a new game.
+struct ThreadTables {
+    OrderingTables ordering;
+    PawnTable pawns;
+
+    void clear ();
+};
+
+// Iterative deepening negamax alpha-beta from state, up to limits.depth
+// (capped by config.searchDepth) or until the node/time budget runs out.
+// history holds the hashes of the game positions before state, for
+// repetition detection. Results are cached in tt, which may be shared
+// with other searches.
+//
+// config.theadCount threads search the same position (Lazy SMP), sharing
+// only tt. Thread i uses threads[i], which is grown to the thread count
+// when it is short. The search ends when the main thread runs out of depth or
+// budget, or as soon as stop is set by another thread. stop is only read,
+// the caller clears it before starting.
+//
+// result receives the principal variation in bestPath along with score,
+// depth, nodes and searchTime (ms) of the last completed iteration.
+// state is left unchanged.
+Move searchBestMove (const EngineConfig& config, const SearchLimits& limits, Board& state,
+                     TranspositionTable& tt, std::vector<std::unique_ptr<ThreadTables>>& threads,
+                     const std::vector<uint64_t>& history, std::atomic<bool>& stop, MoveGenState& result,
+                     const SearchCallback& onIteration = nullptr);
+
+} // end namespace
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include "board.h"
+#include "uci.h"
+
+namespace morphy {
+
+struct SearchLimits;
+
+const uint64_t MOVE_OVERHEAD = 30;     // ms kept back for GUI and transport lag
+const int DEFAULT_MOVES_TO_GO = 30;
+
+// Turns a go command into search limits. The soft deadline is the time
+// we plan to spend, the hard deadline the most we may spend on a move
+// that turns out to be difficult. Both are 0 when the search isn't
+// timed (infinite, depth or nodes only).
+SearchLimits allocateTime (const uci::GoCommand& go, bool white, int maxDepth);
+
+// Decides between iterations whether to start another one. The soft
+// deadline stretches while the best move keeps changing or the score
+// is dropping, and is never allowed past the hard deadline.
+// https://www.chessprogramming.org/Time_Management
+class TimeManager {
+private:
+    uint64_t _soft;
+    uint64_t _hard;
+    Move _lastBest;
+    int _lastScore;
+    int _drop = 0;
+    int _iterations = 0;
+    double _instability = 0;
+
+public:
+    TimeManager (const SearchLimits& limits);
+
+    // Called with the result of every completed iteration.
+    void update (const Move& best, int score);
+    bool softExpired (uint64_t elapsedMs) const;
+};
+
+} // end namespace
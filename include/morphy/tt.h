@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include "board.h"
+
+namespace morphy {
+
+enum class Bound : uint8_t {
+    NONE, UPPER, LOWER, EXACT
+};
+
+struct TTEntry {
+    PackedMove move;
+    int16_t score;
+    int16_t eval;
+    uint8_t depth;
+    Bound bound;
+};
+
+const size_t DEFAULT_HASH_SIZE = 16;        // MB
+const size_t MAX_HASH_SIZE = 1 << 15;       // MB
+
+// Transposition table shared by all search threads. Buckets hold four
+// entries and fill exactly one cache line. Entries are two relaxed
+// atomics, the key xor'd with the data, so a torn write from another
+// thread reads as a miss instead of a corrupt entry.
+// https://www.chessprogramming.org/Shared_Hash_Table#Lockless
+class TranspositionTable {
+private:
+    struct Entry {
+        std::atomic<uint64_t> check{0};
+        std::atomic<uint64_t> data{0};
+    };
+
+    struct alignas(64) Bucket {
+        Entry entries[4];
+    };
+
+    std::unique_ptr<Bucket[]> _buckets;
+    size_t _count = 0;
+    uint8_t _generation = 0;
+
+    Bucket& bucketFor (uint64_t key) const;
+
+public:
+    TranspositionTable (size_t megabytes = DEFAULT_HASH_SIZE);
+
+    // Reallocates and clears the table. Not safe during a search. Throws
+    // std::bad_alloc if the new size can't be allocated, the current
+    // table is kept.
+    void resize (size_t megabytes);
+    void clear ();
+    size_t size () const;
+
+    // Ages every entry written before the next search so they lose
+    // replacement priority over entries from the current search.
+    void newSearch ();
+
+    bool probe (uint64_t key, TTEntry& entry) const;
+    void store (uint64_t key, int depth, int score, int eval, Bound bound, PackedMove move);
+};
+
+} // end namespace
@@ -40,7 +40,8 @@ public:
         std::ostream(this),
         lastWasNewline(true)
     {
-        logHandle.open(path);
+        // An empty path turns logging off
+        if (!path.empty()) logHandle.open(path);
     }
 
     template <class T>
@@ -102,6 +103,8 @@ public:
     UCIConfigurator& setEngineName (const std::string& name);
     UCIConfigurator& setAuthorName (const std::string& name);
     UCIConfigurator& setHashRange (size_t min, size_t max, size_t def = 1);
+    UCIConfigurator& setThreadRange (size_t min, size_t max, size_t def = 1);
+    UCIConfigurator& setEvalFile (const std::string& path, bool enabled);
     UCIConfigurator& setNalimovTableBase (const std::string& path, size_t min, size_t max);
     UCIConfigurator& enablePonder (bool enabled);
     UCIConfigurator& enableOwnBook (bool enabled);
@@ -115,19 +118,40 @@ public:
 };
 
 
+// Parameters of a go command, -1 or 0 where they weren't given.
+struct GoCommand {
+    int64_t wtime = -1;
+    int64_t btime = -1;
+    int64_t winc = 0;
+    int64_t binc = 0;
+    int movestogo = 0;
+    int64_t movetime = -1;
+    int depth = 0;
+    uint64_t nodes = 0;
+    bool infinite = false;
+};
+
+bool parseGo (const std::vector<std::string>& message, GoCommand& go);
 bool parseMove (const std::string& str, uint16_t& from, uint16_t& to);
+bool parseMove (const std::string& str, uint16_t& from, uint16_t& to, PieceType& promotion);
 void splitString (const std::string& str, std::vector<std::string>& strs, char delim);
 void setSpinOption (std::ostream& stream, const std::string& name, const size_t def, const size_t min, const size_t max);
 void setComboOption (std::ostream& stream, const std::string& name, const std::initializer_list<const std::string>& opts);
 void setCheckOption (std::ostream& stream, const std::string& name, bool enabled);
 void setStringOption (std::ostream& stream, const std::string& name, const std::string& value);
 
+// Long algebraic notation (e2e4, e7e8q). Moves are relative to the side
+// to move, white says which side that was.
+std::string moveToString (const Move& move, bool white = true);
+
 void signalReady (std::ostream& stream);
 
 void signalBestMove (std::ostream& stream, const Move& move);
 void signalBestMove (std::ostream& stream, const Move& move, const Move& ponder);
 void logMessage (std::ostream& stream, const std::string& message);
-//void moveGenInfo (std::stringstream& stream, const MoveGenState& gen);
+// Search progress as an info line. The moves in gen.bestPath alternate
+// perspective, white is the side to move at the root.
+void moveGenInfo (std::ostream& stream, const MoveGenState& gen, bool white);
 
 } // end namespace
 } // end namespace
@@ -0,0 +1,230 @@
+#include <morphy/analyze.h>
+#include <morphy/engine.h>
+#include <morphy/fen.h>
+#include <morphy/uci.h>
+
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+using namespace morphy;
+
+static void append_json_string (std::string& out, std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (char c : text) {
+        unsigned char u = c;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (u < 0x20) {
+            out += "\\u00";
+            out += hex[u >> 4];
+            out += hex[u & 15];
+        }
+        else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// The value of an EPD id operation, empty if there isn't one
+static std::string epd_id (std::string_view ops) {
+    size_t pos = 0;
+    while ((pos = ops.find("id", pos)) != std::string_view::npos) {
+        bool start = pos == 0 || ops[pos - 1] == ' ' || ops[pos - 1] == ';';
+        pos += 2;
+        if (!start || pos >= ops.size() || ops[pos] != ' ') continue;
+        while (pos < ops.size() && ops[pos] == ' ') pos++;
+        if (pos < ops.size() && ops[pos] == '"') {
+            size_t end = ops.find('"', pos + 1);
+            if (end == std::string_view::npos) end = ops.size();
+            return std::string(ops.substr(pos + 1, end - pos - 1));
+        }
+        size_t end = ops.find_first_of(" ;", pos);
+        if (end == std::string_view::npos) end = ops.size();
+        return std::string(ops.substr(pos, end - pos));
+    }
+    return {};
+}
+
+std::string morphy::resultToJSON (const AnalysisResult& result) {
+    std::string out = "{\"line\":" + std::to_string(result.line) + ",\"fen\":";
+    append_json_string(out, result.fen);
+    if (!result.id.empty()) {
+        out += ",\"id\":";
+        append_json_string(out, result.id);
+    }
+    if (!result.error.empty()) {
+        out += ",\"error\":";
+        append_json_string(out, result.error);
+        out += '}';
+        return out;
+    }
+
+    const MoveGenState& search = result.search;
+    out += ",\"bestmove\":";
+    if (search.bestPath.empty()) out += "null";
+    else append_json_string(out, uci::moveToString(result.bestMove, result.white));
+
+    out += ",\"score\":{";
+    if (search.score >= SCORE_MATE_BOUND) out += "\"mate\":" + std::to_string((SCORE_MATE - search.score + 1) / 2);
+    else if (search.score <= -SCORE_MATE_BOUND) out += "\"mate\":" + std::to_string(-((SCORE_MATE + search.score) / 2));
+    else out += "\"cp\":" + std::to_string(search.score);
+    out += '}';
+
+    out += ",\"depth\":" + std::to_string(search.depth);
+    out += ",\"nodes\":" + std::to_string(search.nodes);
+    out += ",\"time\":" + std::to_string(search.searchTime);
+    out += ",\"pv\":[";
+    bool white = result.white;
+    for (size_t i = 0; i < search.bestPath.size(); i++) {
+        if (i) out += ',';
+        append_json_string(out, uci::moveToString(search.bestPath[i], white));
+        white = !white;
+    }
+    out += "]}";
+    return out;
+}
+
+namespace {
+
+struct Job {
+    size_t index;       // position in the input, from 0
+    size_t line;
+    std::string text;
+};
+
+// Hands lines from the reader to the workers, and their results back
+// in input order. The reader is held back once it gets window positions
+// ahead of the output so a slow position doesn't buffer the whole file.
+class AnalysisQueue {
+private:
+    std::mutex _lock;
+    std::condition_variable _jobReady;
+    std::condition_variable _roomReady;
+    std::deque<Job> _jobs;
+    std::map<size_t, std::string> _done;
+    size_t _queued = 0;
+    size_t _written = 0;
+    size_t _window;
+    bool _closed = false;
+    std::ostream& _out;
+
+public:
+    AnalysisQueue (std::ostream& out, size_t window) :
+        _window(window),
+        _out(out)
+    {}
+
+    void push (size_t line, std::string text) {
+        std::unique_lock<std::mutex> lock(_lock);
+        _roomReady.wait(lock, [&] { return _queued - _written < _window; });
+        _jobs.push_back({_queued++, line, std::move(text)});
+        _jobReady.notify_one();
+    }
+
+    // No more jobs, pop returns false once the queue is empty
+    void close () {
+        std::lock_guard<std::mutex> lock(_lock);
+        _closed = true;
+        _jobReady.notify_all();
+    }
+
+    bool pop (Job& job) {
+        std::unique_lock<std::mutex> lock(_lock);
+        _jobReady.wait(lock, [&] { return !_jobs.empty() || _closed; });
+        if (_jobs.empty()) return false;
+        job = std::move(_jobs.front());
+        _jobs.pop_front();
+        return true;
+    }
+
+    // Stores the result and writes out every one that is now in order
+    void finish (size_t index, std::string json) {
+        std::lock_guard<std::mutex> lock(_lock);
+        _done.emplace(index, std::move(json));
+        bool wrote = false;
+        for (auto it = _done.begin(); it != _done.end() && it->first == _written; it = _done.erase(it)) {
+            _out << it->second << '\n';
+            _written++;
+            wrote = true;
+        }
+        if (wrote) {
+            _out.flush();
+            _roomReady.notify_one();
+        }
+    }
+
+    // Waits for the output to catch up with everything pushed
+    size_t drain () {
+        std::unique_lock<std::mutex> lock(_lock);
+        _roomReady.wait(lock, [&] { return _written == _queued; });
+        return _written;
+    }
+};
+
+} // end namespace
+
+static void analyze_worker (AnalysisQueue& queue, const AnalysisConfig& config) {
+    EngineConfig engineConfig = DEFAULT_ENGINE_CONFIG;
+    engineConfig.theadCount = 1;
+    engineConfig.hashSize = config.hashSize;
+    engineConfig.network = config.network;
+    Engine engine(engineConfig);
+
+    Job job;
+    while (queue.pop(job)) {
+        AnalysisResult result{};
+        result.line = job.line;
+        result.fen = job.text;
+
+        Board board;
+        fen::ParseResult parsed = fen::fen_to_board(board, job.text);
+        if (!parsed) {
+            result.error = parsed.error;
+        }
+        else {
+            std::string_view text = job.text;
+            result.id = epd_id(text.substr(parsed.offset));
+            result.white = board.is_white;
+            engine.newGame();
+            engine.setBoard(board);
+            result.bestMove = engine.findBestMove(config.limits);
+            result.search = engine.lastSearch();
+        }
+        queue.finish(job.index, resultToJSON(result));
+    }
+}
+
+size_t morphy::analyzePositions (std::istream& in, std::ostream& out, const AnalysisConfig& config) {
+    int workerCount = config.workerCount;
+    if (workerCount <= 0) workerCount = std::max(1u, std::thread::hardware_concurrency());
+
+    AnalysisQueue queue(out, static_cast<size_t>(workerCount) * 4);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workerCount; i++) {
+        workers.emplace_back(analyze_worker, std::ref(queue), std::cref(config));
+    }
+
+    std::string text;
+    size_t line = 0;
+    while (std::getline(in, text)) {
+        line++;
+        if (!text.empty() && text.back() == '\r') text.pop_back();
+        size_t first = text.find_first_not_of(" \t");
+        if (first == std::string::npos || text[first] == '#') continue;
+        queue.push(line, text.substr(first));
+    }
+    queue.close();
+    size_t written = queue.drain();
+    for (auto& worker : workers) worker.join();
+    return written;
+}
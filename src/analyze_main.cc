@@ -0,0 +1,64 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <morphy/analyze.h>
+#include <morphy/nnue.h>
+
+using namespace morphy;
+
+static void usage () {
+    std::cerr << "usage: morphy_analyze [--depth N] [--nodes N] [--movetime MS] [--threads N] [--hash MB] [--eval-file FILE] [FILE]\n"
+              << "  FILE        one FEN or EPD position per line, defaults to stdin\n"
+              << "  --depth     search depth per position (default 10)\n"
+              << "  --nodes     node budget per position, 0 is unlimited (default 0)\n"
+              << "  --movetime  time per position in ms, 0 is unlimited (default 0)\n"
+              << "  --threads   positions searched at once, 0 uses every core (default 0)\n"
+              << "  --hash      transposition table per thread in MB (default 16)\n"
+              << "  --eval-file NNUE weights to evaluate with instead of the classical eval\n";
+}
+
+int main (int argc, char** argv) {
+    AnalysisConfig config = DEFAULT_ANALYSIS_CONFIG;
+    std::string evalFile;
+    std::string input;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--depth") && i + 1 < argc) config.limits.depth = std::stoi(argv[++i]);
+        else if (!strcmp(argv[i], "--nodes") && i + 1 < argc) config.limits.nodes = std::stoull(argv[++i]);
+        else if (!strcmp(argv[i], "--movetime") && i + 1 < argc) {
+            config.limits.softTime = config.limits.hardTime = std::stoull(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) config.workerCount = std::stoi(argv[++i]);
+        else if (!strcmp(argv[i], "--hash") && i + 1 < argc) config.hashSize = std::stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--eval-file") && i + 1 < argc) evalFile = argv[++i];
+        else if (argv[i][0] != '-' && input.empty()) input = argv[i];
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    nnue::Network network;
+    if (!evalFile.empty()) {
+        std::string error;
+        if (!nnue::loadNetwork(network, evalFile, error)) {
+            std::cerr << "can't load " << evalFile << ": " << error << "\n";
+            return 2;
+        }
+        config.network = &network;
+    }
+
+    if (input.empty()) {
+        analyzePositions(std::cin, std::cout, config);
+        return 0;
+    }
+    std::ifstream file(input);
+    if (!file) {
+        std::cerr << "can't open " << input << "\n";
+        return 2;
+    }
+    analyzePositions(file, std::cout, config);
+    return 0;
+}
@@ -1,11 +1,16 @@
 #include <morphy/board.h>
+#include <morphy/eval.h>
 
 #include <iostream>
 #include <sstream>
 #include <vector>
 #include <array>
 #include <random>
-#include <format>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define MORPHY_HAS_PEXT 1
+#endif
 
 #define BIT_MASK(idx) (static_cast<uint64_t>(1) << (idx))
 #define SET_BIT(v,idx) ((v) | BIT_MASK(idx))
@@ -20,15 +25,6 @@
 
 using namespace morphy;
 
-enum Direction {
-    NORTH, NORTHEAST, EAST, SOUTHEAST, SOUTH, SOUTHWEST, WEST, NORTHWEST
-};
-
-MoveGenCache::MoveGenCache (const Board& board) :
-    allPieces(all_pieces(board)),
-    enemyPieces(enemy_pieces(board))
-{}
-
 bool MaskIterator::hasBits() const {
     return mask != 0;
 }
@@ -42,7 +38,7 @@ bool MaskIterator::nextBit(uint16_t * dest){
 }
 
 int MaskIterator::bitCount() const {
-    return __builtin_clzll(mask);
+    return __builtin_popcountll(mask);
 }
 
  void MaskIterator::clearBit(uint16_t idx) {
@@ -84,9 +80,6 @@ static constexpr uint64_t file_mask (uint8_t file) {
     return static_cast<uint64_t>(0x101010101010101) << file;
 }
 
-static constexpr uint64_t two_guard = file_mask(0) | file_mask(1);
-static constexpr uint64_t three_guard = two_guard | file_mask(2);
-
 // https://chessprogramming.wikispaces.com/On+an+empty+Board#RayAttacks
 static constexpr uint64_t diagonal_mask(uint8_t center) {
    const uint64_t maindia = 0x8040201008040201;
@@ -144,101 +137,296 @@ static constexpr uint64_t flip_vertical(uint64_t x)
     ( (x >> 56)                        );
 }
 
-static constexpr uint64_t full_rank_mask (uint8_t start, uint8_t end){
-    uint8_t height = end - start;
-    if (height == 0) return 0;
+// Slider attacks are looked up from tables indexed by the relevant
+// occupancy of the square (the ray squares minus the board edge).
+// The index is computed either with a "fancy" magic multiply or, on
+// CPUs with BMI2, with PEXT. Which one is used is picked once at startup.
+// https://www.chessprogramming.org/Magic_Bitboards
+struct Magic {
+    uint64_t mask;
+    uint64_t magic;
+    uint64_t* attacks;
+    uint8_t shift;
+};
+
+static Magic rook_magics[64];
+static Magic bishop_magics[64];
+static uint64_t rook_table[0x19000];
+static uint64_t bishop_table[0x1480];
+static bool use_pext = false;
+
+#ifdef MORPHY_HAS_PEXT
+__attribute__((target("bmi2")))
+static uint64_t pext_u64 (uint64_t v, uint64_t mask) {
+    return _pext_u64(v, mask);
+}
+#endif
 
-    uint64_t fullMask = 0xffffffffffffffff;
+static inline uint64_t magic_index (const Magic& m, uint64_t occupied) {
+#ifdef MORPHY_HAS_PEXT
+    if (use_pext) return pext_u64(occupied, m.mask);
+#endif
+    return ((occupied & m.mask) * m.magic) >> m.shift;
+}
 
-    fullMask = fullMask >> ((8 - height) * 8);
-    fullMask = fullMask << (start * 8);
-    return fullMask;
+static inline uint64_t rook_attacks (uint16_t sq, uint64_t occupied) {
+    const Magic& m = rook_magics[sq];
+    return m.attacks[magic_index(m, occupied)];
 }
 
-static constexpr uint64_t full_file_mask (uint8_t start, uint8_t end){
-    return flipDiagA1H8(full_rank_mask(start, end));
+static inline uint64_t bishop_attacks (uint16_t sq, uint64_t occupied) {
+    const Magic& m = bishop_magics[sq];
+    return m.attacks[magic_index(m, occupied)];
 }
 
-static constexpr uint64_t ray_in_direction (const Vec2& pos, Direction dir){
-    // TODO: In the future use a precomputed lookup table + magic bit boards
-    switch (dir) {
-    case Direction::NORTH:
-        return file_mask(pos.x) & full_rank_mask(pos.y+1, 8);
-    case Direction::SOUTH:
-        return file_mask(pos.x) & full_rank_mask(0, pos.y);
-    case Direction::EAST:
-        return rank_mask(pos.y) & full_file_mask(pos.x+1, 8);
-    case Direction::WEST:
-        return rank_mask(pos.y) & full_file_mask(0, pos.x);
-    case Direction::NORTHEAST:
-        return diagonal_mask(pos.idx) & full_rank_mask(pos.y+1, 8);
-    case Direction::SOUTHWEST:
-        return diagonal_mask(pos.idx) & full_rank_mask(0, pos.y);
-    case Direction::NORTHWEST:
-        return antidiagonal_mask(pos.idx) & full_rank_mask(pos.y+1, 8);
-    case Direction::SOUTHEAST:
-        return antidiagonal_mask(pos.idx) & full_rank_mask(0, pos.y);
+// Slow reference used only to fill the tables.
+static uint64_t sliding_attacks (uint16_t sq, uint64_t occupied, const int (&deltas)[4][2]) {
+    uint64_t mask = 0;
+    for (const auto& d : deltas) {
+        int x = sq % 8 + d[0];
+        int y = sq / 8 + d[1];
+        while (x >= 0 && x < 8 && y >= 0 && y < 8) {
+            mask = SET_BIT(mask, ROW_MAJOR(x,y));
+            if (CHECK_BIT(occupied, ROW_MAJOR(x,y))) break;
+            x += d[0];
+            y += d[1];
+        }
     }
+    return mask;
+}
+
+static uint64_t random_u64 (uint64_t& state) {
+    // xorshift64*
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
 }
 
-static uint64_t rayUntilBlocked (uint64_t own, uint64_t enemy, const Vec2& pos, Direction dir) {
-    // Includes cell where blocked
-    uint64_t blockers = CLEAR_BIT((own | enemy), pos);
-    uint64_t move_mask = ray_in_direction(pos, dir);
-    uint8_t hit = LSB_FIRST(move_mask & blockers) - 1;
-    uint64_t anti_mask = ray_in_direction({hit}, dir);
-    return move_mask & ~anti_mask;
+static void init_magics (Magic* magics, uint64_t* table, const int (&deltas)[4][2]) {
+    uint64_t occupancy[4096];
+    uint64_t reference[4096];
+    int epoch[4096] = {};
+    int attempt = 0;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+    for (uint16_t sq = 0; sq < 64; sq++) {
+        uint64_t edges = ((rank_mask(0) | rank_mask(7)) & ~rank_mask(sq / 8))
+                       | ((file_mask(0) | file_mask(7)) & ~file_mask(sq % 8));
+        Magic& m = magics[sq];
+        m.mask = sliding_attacks(sq, 0, deltas) & ~edges;
+        m.shift = 64 - __builtin_popcountll(m.mask);
+        m.attacks = sq == 0 ? table : magics[sq - 1].attacks + (1ULL << (64 - magics[sq - 1].shift));
+
+        // Carry-Rippler enumeration of every subset of the mask
+        int size = 0;
+        uint64_t b = 0;
+        do {
+            occupancy[size] = b;
+            reference[size] = sliding_attacks(sq, b, deltas);
+            if (use_pext) m.attacks[magic_index(m, b)] = reference[size];
+            size++;
+            b = (b - m.mask) & m.mask;
+        } while (b);
+
+        if (use_pext) continue;
+
+        // Search for a magic that maps every occupancy to a slot without
+        // destructive collisions. epoch avoids clearing the table per try.
+        for (int i = 0; i < size; ) {
+            m.magic = 0;
+            while (__builtin_popcountll((m.magic * m.mask) >> 56) < 6) {
+                m.magic = random_u64(seed) & random_u64(seed) & random_u64(seed);
+            }
+            attempt++;
+            for (i = 0; i < size; i++) {
+                uint64_t idx = magic_index(m, occupancy[i]);
+                if (epoch[idx] < attempt) {
+                    epoch[idx] = attempt;
+                    m.attacks[idx] = reference[i];
+                }
+                else if (m.attacks[idx] != reference[i]) break;
+            }
+        }
+    }
 }
 
+static const int rook_deltas[4][2] = {{0,1},{0,-1},{1,0},{-1,0}};
+static const int bishop_deltas[4][2] = {{1,1},{1,-1},{-1,1},{-1,-1}};
+
+// Squares strictly between two aligned squares, and the full line
+// through them. Both are empty for squares that don't share a line.
+static uint64_t between_table[64][64];
+static uint64_t line_table[64][64];
+
+static void init_line_tables () {
+    for (uint16_t a = 0; a < 64; a++) {
+        for (uint16_t b = 0; b < 64; b++) {
+            if (a == b) continue;
+            if (CHECK_BIT(rook_attacks(a, 0), b)) {
+                between_table[a][b] = rook_attacks(a, BIT_MASK(b)) & rook_attacks(b, BIT_MASK(a));
+                line_table[a][b] = (rook_attacks(a, 0) & rook_attacks(b, 0)) | BIT_MASK(a) | BIT_MASK(b);
+            }
+            else if (CHECK_BIT(bishop_attacks(a, 0), b)) {
+                between_table[a][b] = bishop_attacks(a, BIT_MASK(b)) & bishop_attacks(b, BIT_MASK(a));
+                line_table[a][b] = (bishop_attacks(a, 0) & bishop_attacks(b, 0)) | BIT_MASK(a) | BIT_MASK(b);
+            }
+        }
+    }
+}
+
+static bool init_slider_tables () {
+#ifdef MORPHY_HAS_PEXT
+    // Runs from a static initializer, possibly before the runtime has
+    // filled in the CPU features
+    __builtin_cpu_init();
+    use_pext = __builtin_cpu_supports("bmi2");
+#endif
+    init_magics(rook_magics, rook_table, rook_deltas);
+    init_magics(bishop_magics, bishop_table, bishop_deltas);
+    init_line_tables();
+    return true;
+}
+
+static const bool slider_tables_ready = init_slider_tables();
+
+// Knights, kings and pawns don't depend on occupancy, so their
+// attacks are plain per-square tables built at compile time.
+struct Offset {
+    int x;
+    int y;
+};
+
+template <size_t N>
+static constexpr std::array<uint64_t,64> leaper_table (const std::array<Offset,N>& offsets) {
+    std::array<uint64_t,64> table{};
+    for (int sq = 0; sq < 64; sq++) {
+        for (const auto& o : offsets) {
+            int x = sq % 8 + o.x;
+            int y = sq / 8 + o.y;
+            if (x >= 0 && x < 8 && y >= 0 && y < 8) table[sq] = SET_BIT(table[sq], ROW_MAJOR(x,y));
+        }
+    }
+    return table;
+}
+
+static constexpr std::array<uint64_t,64> knight_table = leaper_table<8>({{
+    {1,2}, {2,1}, {2,-1}, {1,-2}, {-1,-2}, {-2,-1}, {-2,1}, {-1,2}
+}});
+
+static constexpr std::array<uint64_t,64> king_table = leaper_table<8>({{
+    {0,1}, {1,1}, {1,0}, {1,-1}, {0,-1}, {-1,-1}, {-1,0}, {-1,1}
+}});
+
+// Indexed by side relative to the board: 0 is the side to move (pawns
+// move north), 1 is the opponent (pawns move south).
+static constexpr std::array<std::array<uint64_t,64>,2> pawn_attack_table {{
+    leaper_table<2>({{ {-1,1}, {1,1} }}),
+    leaper_table<2>({{ {-1,-1}, {1,-1} }})
+}};
+
+static_assert(knight_table[0] == 0x20400);
+static_assert(king_table[7] == 0xc040);
+static_assert(pawn_attack_table[0][8] == 0x20000);
+static_assert(pawn_attack_table[1][63] == 0x40000000000000);
+
+// Zobrist keys are for absolute squares and colours, so a position
+// hashes the same whichever side the board is currently relative to.
+// https://www.chessprogramming.org/Zobrist_Hashing
+struct ZobristKeys {
+    uint64_t pieces[2][6][64];  // [white/black][PieceType][square]
+    uint64_t castling[16];
+    uint64_t en_passant[8];     // by file
+    uint64_t black_to_move;
+};
+
+static constexpr uint64_t splitmix64 (uint64_t& state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static constexpr ZobristKeys make_zobrist_keys () {
+    ZobristKeys keys{};
+    uint64_t state = 0x4d6f72706879ULL;
+    for (auto& color : keys.pieces)
+        for (auto& type : color)
+            for (auto& key : type) key = splitmix64(state);
+    for (auto& key : keys.castling) key = splitmix64(state);
+    for (auto& key : keys.en_passant) key = splitmix64(state);
+    keys.black_to_move = splitmix64(state);
+    return keys;
+}
+
+static constexpr ZobristKeys zobrist = make_zobrist_keys();
+
+// Pieces on squares in current_bb belong to the side to move, so callers
+// keep current_bb up to date before setPiece and after clearPiece.
+static uint64_t piece_key (const Board& board, PieceType type, uint16_t sq) {
+    bool white = CHECK_BIT(board.current_bb, sq) == board.is_white;
+    return zobrist.pieces[white ? 0 : 1][static_cast<uint8_t>(type)][relativeSquare(board.is_white, sq)];
+}
+
+// Adds (sign 1) or removes (sign -1) a piece's share of the tapered eval
+// sums. Like piece_key the colour comes from current_bb.
+static void update_piece_square (Board& board, PieceType type, uint16_t sq, int sign) {
+    uint8_t t = static_cast<uint8_t>(type);
+    uint16_t abs = relativeSquare(board.is_white, sq);
+    if (CHECK_BIT(board.current_bb, sq) == board.is_white) {
+        board.psq_mg += sign * pst_mg[t][abs];
+        board.psq_eg += sign * pst_eg[t][abs];
+    }
+    else {
+        board.psq_mg -= sign * pst_mg[t][abs ^ 56];
+        board.psq_eg -= sign * pst_eg[t][abs ^ 56];
+    }
+    board.phase += sign * phase_weight[t];
+}
 
-static constexpr uint64_t knight_mask (uint64_t own, uint64_t enemy, const Vec2& pos) {
-    uint64_t tl = 258;
-    uint64_t bl = 513;
-    int16_t idx = pos.idx;
-    uint64_t mask = (tl << (idx + 9)) | (bl << (idx + 6));
-    if (idx - 15 >= 0) mask |= bl << (idx - 15);
-    if (idx - 18 >= 0) mask |= tl << (idx - 18);
-    if (pos.x <= 1) mask &= three_guard;
-    else if (pos.x >= 6) mask &= (three_guard << 5);
-    return mask & ~own;
+static uint64_t castle_key (const Board& board) {
+    uint8_t white = board.is_white ? board.current_castle_flags : board.other_castle_flags;
+    uint8_t black = board.is_white ? board.other_castle_flags : board.current_castle_flags;
+    // CASTLE_KINGSIDE is bit 0 and CASTLE_QUEENSIDE bit 2; pack into 4 bits
+    uint8_t idx = (white & 1) | ((white >> 1) & 2) | ((black & 1) << 2) | ((black << 1) & 8);
+    return zobrist.castling[idx];
+}
+
+static uint64_t en_passant_key (const Board& board) {
+    return board.en_passant_sq ? zobrist.en_passant[board.en_passant_sq % 8] : 0;
+}
+
+static constexpr uint64_t knight_mask (uint64_t own, [[maybe_unused]] uint64_t enemy, const Vec2& pos) {
+    return knight_table[pos.idx] & ~own;
 }
 
 static uint64_t bishop_mask (uint64_t own, uint64_t enemy, const Vec2& pos) {
-    return rayUntilBlocked(own, enemy, pos, Direction::NORTHEAST)
-         | rayUntilBlocked(own, enemy, pos, Direction::NORTHWEST)
-         | rayUntilBlocked(own, enemy, pos, Direction::SOUTHEAST)
-         | rayUntilBlocked(own, enemy, pos, Direction::SOUTHWEST);
+    return bishop_attacks(pos.idx, own | enemy) & ~own;
 }
 
-static constexpr uint64_t rook_mask (uint64_t own, uint64_t enemy, const Vec2& pos) {
-    return rayUntilBlocked(own,enemy, pos, Direction::NORTH)
-         | rayUntilBlocked(own,enemy, pos, Direction::SOUTH)
-         | rayUntilBlocked(own,enemy, pos, Direction::EAST)
-         | rayUntilBlocked(own,enemy, pos, Direction::WEST);
+static uint64_t rook_mask (uint64_t own, uint64_t enemy, const Vec2& pos) {
+    return rook_attacks(pos.idx, own | enemy) & ~own;
 }
 
-static constexpr uint64_t queen_mask (uint64_t own, uint64_t enemy, const Vec2& pos) {
-    return rook_mask(own,enemy,pos) | bishop_mask(own,enemy,pos);
+static uint64_t queen_mask (uint64_t own, uint64_t enemy, const Vec2& pos) {
+    uint64_t occupied = own | enemy;
+    return (rook_attacks(pos.idx, occupied) | bishop_attacks(pos.idx, occupied)) & ~own;
 }
 
-static uint64_t king_mask (uint64_t own, uint64_t enemy, const Vec2& pos) {
-    uint64_t mask = SET_BIT(0, pos);
-    mask |= (mask << 1 | mask >> 1 | mask << 7 | mask << 8 | mask << 9 | mask >> 7 | mask >> 8 | mask >> 9);
-    uint64_t edge_mask = pos.x == 0 || pos.x == 7 ? file_mask(7 - pos.x) : 0;
-    return CLEAR_BIT((mask & ~own) & ~edge_mask, pos);
+static constexpr uint64_t king_mask (uint64_t own, [[maybe_unused]] uint64_t enemy, const Vec2& pos) {
+    return king_table[pos.idx] & ~own;
 }
 
-static uint64_t pawn_attack_mask (uint64_t own, uint64_t enemy, const Vec2& pos) {
-    uint64_t edge_mask = pos.x == 0 || pos.x == 7 ? file_mask(7 - pos.x) : 0;
-    uint64_t pmask = SET_BIT(0, pos);
-    uint64_t mask = (pmask << 7) & enemy | (pmask << 9) & enemy;
-    return mask & ~own;
+static constexpr uint64_t pawn_attack_mask ([[maybe_unused]] uint64_t own, uint64_t enemy, const Vec2& pos) {
+    return pawn_attack_table[0][pos.idx] & enemy;
 }
 
 static uint64_t pawn_move_mask (uint64_t own, uint64_t enemy, const Vec2& pos) {
     uint64_t blockers = own | enemy;
+    if (pos.idx >= 56) return 0;
     uint64_t mask = SET_BIT(0, pos.idx + 8) & ~blockers;
-    if (mask) mask = SET_BIT(mask, pos.idx + 16) & ~blockers;
+    // Double push only from the second rank
+    if (mask && pos.y == 1) mask = SET_BIT(mask, pos.idx + 16) & ~blockers;
     return mask;
 }
 
@@ -247,16 +435,27 @@ static uint64_t pawn_mask (uint64_t own, uint64_t enemy, const Vec2& pos){
 }
 
 
-static uint64_t castle_mask (uint64_t own, uint64_t enemy, uint8_t flags, const Vec2& pos) {
+static uint64_t castle_mask (uint64_t own, uint64_t enemy, uint64_t rooks, uint8_t flags, const Vec2& pos) {
     uint64_t mask = 0;
-    if (pos.idx != 3) return 0;
+    if (pos.idx != 4) return 0;
     // Treat own pieces as capture. This way we can check if king
     // has clear path to rook.
-    if (CHECK_BIT(flags,CASTLE_KINGSIDE) && rayUntilBlocked(enemy,own,pos,Direction::EAST) == 15) mask |= 2;
-    if (CHECK_BIT(flags,CASTLE_QUEENSIDE) && rayUntilBlocked(enemy,own,pos,Direction::WEST) == 0xf8) mask |= 0x20;
+    uint64_t rays = rook_attacks(pos.idx, own | enemy) & own & rooks;
+    if ((flags & CASTLE_KINGSIDE) && CHECK_BIT(rays,7)) mask |= BIT_MASK(6);
+    if ((flags & CASTLE_QUEENSIDE) && CHECK_BIT(rays,0)) mask |= BIT_MASK(2);
     return mask;
 }
 
+// Enemy pieces attacking sq given the occupancy. Passing an occupancy
+// without our king lets sliders see through it for king move checks.
+static uint64_t enemy_attackers (const Board& state, uint64_t enemy, uint16_t sq, uint64_t occupied) {
+    return ((pawn_attack_table[0][sq] & state.pawns)
+          | (knight_table[sq] & state.knights)
+          | (king_table[sq] & state.kings)
+          | (bishop_attacks(sq, occupied) & (state.bishops | state.queens))
+          | (rook_attacks(sq, occupied) & (state.rooks | state.queens))) & enemy;
+}
+
 void morphy::initializeBoard (Board& board) {
     board.rooks   = SET_BIT(0,ROW_MAJOR(0,0)) | SET_BIT(0,ROW_MAJOR(7,0)) | SET_BIT(0,ROW_MAJOR(0,7)) | SET_BIT(0,ROW_MAJOR(7,7));
     board.knights = SET_BIT(0,ROW_MAJOR(1,0)) | SET_BIT(0,ROW_MAJOR(6,0)) | SET_BIT(0,ROW_MAJOR(1,7)) | SET_BIT(0,ROW_MAJOR(6,7));
@@ -268,6 +467,12 @@ void morphy::initializeBoard (Board& board) {
     board.other_castle_flags = board.current_castle_flags;
     board.current_bb = 0xffff;
     board.is_white = true;
+    board.en_passant_sq = 0;
+    board.halfmove_clock = 0;
+    board.fullmove_number = 1;
+    board.hash = zobristHash(board);
+    board.pawn_hash = zobristPawnHash(board);
+    refreshPieceSquare(board);
 }
 
 void morphy::flipBoard (Board& board) {
@@ -280,6 +485,11 @@ void morphy::flipBoard (Board& board) {
     board.knights = FLIP_BB(board.knights);
     board.kings   = FLIP_BB(board.kings);
     board.is_white = !board.is_white;
+    std::swap(board.current_castle_flags, board.other_castle_flags);
+    if (board.en_passant_sq) board.en_passant_sq ^= 56;
+    // Pieces, castle rights and the en passant file are stored in absolute
+    // terms in the key, so only the side to move changes.
+    board.hash ^= zobrist.black_to_move;
 }
 
 void morphy::setBoardColor (Board& board, bool white){
@@ -292,11 +502,40 @@ void morphy::setBoardColor (Board& board, bool white){
 void morphy::setPiece (Board& board, PieceType type, const Vec2& pos) {
     uint64_t* bb = getPieceBoard(board, type);
     *bb = SET_BIT(*bb, pos);
+    uint64_t key = piece_key(board, type, pos);
+    board.hash ^= key;
+    if (type == PieceType::PAWN) board.pawn_hash ^= key;
+    update_piece_square(board, type, pos.idx, 1);
 }
 
 void morphy::clearPiece (Board& board, PieceType type, const Vec2& pos) {
     uint64_t* bb = getPieceBoard(board, type);
     *bb = CLEAR_BIT(*bb, pos);
+    uint64_t key = piece_key(board, type, pos);
+    board.hash ^= key;
+    if (type == PieceType::PAWN) board.pawn_hash ^= key;
+    update_piece_square(board, type, pos.idx, -1);
+}
+
+uint64_t morphy::zobristHash (const Board& board) {
+    uint64_t hash = zobristPawnHash(board);
+    for (const auto t : all_piece_types) {
+        if (t == PieceType::NONE || t == PieceType::PAWN) continue;
+        MaskIterator iter{*getPieceBoard(board, t)};
+        uint16_t idx = 0;
+        while (iter.nextBit(&idx)) hash ^= piece_key(board, t, idx);
+    }
+    hash ^= castle_key(board) ^ en_passant_key(board);
+    if (!board.is_white) hash ^= zobrist.black_to_move;
+    return hash;
+}
+
+uint64_t morphy::zobristPawnHash (const Board& board) {
+    uint64_t hash = 0;
+    MaskIterator iter{board.pawns};
+    uint16_t idx = 0;
+    while (iter.nextBit(&idx)) hash ^= piece_key(board, PieceType::PAWN, idx);
+    return hash;
 }
 
 uint64_t morphy::all_pieces (const Board& board) {
@@ -353,31 +592,105 @@ PieceType morphy::getPieceTypeAtCell (const Board& board, uint16_t cell) {
 
 }
 
-MoveIterator morphy::generateMoveMask (MoveGenCache& genState, const Board& state, const Vec2& pos, PieceType type) {
-    uint64_t mask = 0;
+// Every square the given enemy pieces attack. Pawns are done set-wise,
+// queens count as both sliders.
+static uint64_t enemy_attack_map (const Board& state, uint64_t enemy, uint64_t occupied) {
+    uint64_t pawns = state.pawns & enemy;
+    // Enemy pawns capture south
+    uint64_t attacks = ((pawns & ~file_mask(0)) >> 9) | ((pawns & ~file_mask(7)) >> 7);
+    uint16_t idx = 0;
+    MaskIterator knights{state.knights & enemy};
+    while (knights.nextBit(&idx)) attacks |= knight_table[idx];
+    MaskIterator kings{state.kings & enemy};
+    while (kings.nextBit(&idx)) attacks |= king_table[idx];
+    MaskIterator diagonal{(state.bishops | state.queens) & enemy};
+    while (diagonal.nextBit(&idx)) attacks |= bishop_attacks(idx, occupied);
+    MaskIterator straight{(state.rooks | state.queens) & enemy};
+    while (straight.nextBit(&idx)) attacks |= rook_attacks(idx, occupied);
+    return attacks;
+}
+
+MoveGenCache::MoveGenCache (const Board& board) :
+    allPieces(all_pieces(board)),
+    enemyPieces(enemy_pieces(board)),
+    kingSq(0),
+    checkers(0),
+    pinned(0)
+{
+    uint64_t ownKing = board.kings & board.current_bb;
+    kingThreats = enemy_attack_map(board, enemyPieces, allPieces & ~ownKing);
+    if (!ownKing) return;
+    kingSq = LSB_FIRST(ownKing) - 1;
+    checkers = enemy_attackers(board, enemyPieces, kingSq, allPieces);
+
+    // Enemy sliders that would hit the king if only enemy pieces blocked.
+    // A single own piece between one of them and the king is pinned.
+    uint64_t snipers = ((rook_attacks(kingSq, enemyPieces) & (board.rooks | board.queens))
+                      | (bishop_attacks(kingSq, enemyPieces) & (board.bishops | board.queens))) & enemyPieces;
+    uint16_t idx = 0;
+    MaskIterator iter{snipers};
+    while (iter.nextBit(&idx)) {
+        uint64_t blockers = between_table[kingSq][idx] & allPieces;
+        if (blockers && !(blockers & (blockers - 1))) pinned |= blockers & board.current_bb;
+    }
+}
+
+static uint64_t pseudo_move_mask (const Board& state, uint64_t enemy, const Vec2& pos, PieceType type) {
     uint64_t own = state.current_bb;
-    uint64_t enemy = genState.enemyPieces;
 
     switch(type) {
-    case PieceType::ROOK:   mask = rook_mask(own,enemy,pos); break;
-    case PieceType::KNIGHT: mask = knight_mask(own,enemy,pos); break;
-    case PieceType::BISHOP: mask = bishop_mask(own,enemy,pos); break;
-    case PieceType::QUEEN:  mask = queen_mask(own,enemy,pos); break;
-    case PieceType::PAWN:   mask = pawn_mask(own,enemy,pos); break;
+    case PieceType::ROOK:   return rook_mask(own,enemy,pos);
+    case PieceType::KNIGHT: return knight_mask(own,enemy,pos);
+    case PieceType::BISHOP: return bishop_mask(own,enemy,pos);
+    case PieceType::QUEEN:  return queen_mask(own,enemy,pos);
+    case PieceType::PAWN: {
+        uint64_t ep = state.en_passant_sq ? BIT_MASK(state.en_passant_sq) : 0;
+        return pawn_mask(own,enemy | ep,pos);
+    }
     case PieceType::KING:{
-        mask = king_mask(own,enemy,pos);
-        if (state.current_castle_flags != 0) mask |= castle_mask(own,enemy,state.current_castle_flags,pos);
-        break;
+        uint64_t mask = king_mask(own,enemy,pos);
+        if (state.current_castle_flags != 0) mask |= castle_mask(own,enemy,state.rooks,state.current_castle_flags,pos);
+        return mask;
     }
-    case PieceType::NONE: mask = 0;
+    case PieceType::NONE: return 0;
     }
+    return 0;
+}
+
+MoveIterator morphy::generateMoveMask (MoveGenCache& genState, const Board& state, const Vec2& pos, PieceType type) {
+    uint64_t mask = pseudo_move_mask(state, genState.enemyPieces, pos, type);
     return {type, static_cast<uint16_t>(pos.idx), {mask}};
 }
 
+// Pseudo legal moves of the given pawns, all at once by shifting the
+// whole bitboard. Only pawns on the third rank after a single push can
+// push again.
+// https://www.chessprogramming.org/Pawn_Pushes_(Bitboards)
+static void pawn_move_sets (MoveGenCache& genState, const Board& state, uint64_t pawns) {
+    uint64_t empty = ~genState.allPieces;
+    uint64_t enemy = genState.enemyPieces;
+    genState.pawnPushes = (pawns << 8) & empty;
+    genState.pawnDoublePushes = ((genState.pawnPushes & rank_mask(2)) << 8) & empty;
+    genState.pawnCapturesWest = ((pawns & ~file_mask(0)) << 7) & enemy;
+    genState.pawnCapturesEast = ((pawns & ~file_mask(7)) << 9) & enemy;
+    // Our pawns capture onto the square from where an enemy pawn there would attack
+    genState.pawnEnPassant = state.en_passant_sq ? pawn_attack_table[1][state.en_passant_sq] & pawns : 0;
+}
+
+// Moves in the pawn sets, each promotion counting once per piece
+static uint64_t pawn_move_count (const MoveGenCache& genState) {
+    uint64_t count = __builtin_popcountll(genState.pawnDoublePushes) + __builtin_popcountll(genState.pawnEnPassant);
+    for (uint64_t set : {genState.pawnPushes, genState.pawnCapturesWest, genState.pawnCapturesEast}) {
+        count += __builtin_popcountll(set) + 3 * __builtin_popcountll(set & rank_mask(7));
+    }
+    return count;
+}
+
 void morphy::generateAllMoves (MoveGenCache& genState, const Board& state) {
-    uint64_t moveCount = 0;
+    pawn_move_sets(genState, state, state.pawns & state.current_bb);
+    uint64_t moveCount = pawn_move_count(genState);
     for (const PieceType& t : all_piece_types) {
-        if (t == PieceType::NONE) continue;
+        if (t == PieceType::NONE || t == PieceType::PAWN) continue;
         MaskIterator mask{getPieceBoard(state,state.current_bb,t)};
         uint16_t idx = 0;
         while (mask.nextBit(&idx)) {
@@ -389,19 +702,104 @@ void morphy::generateAllMoves (MoveGenCache& genState, const Board& state) {
     genState.moveCount = moveCount;
 }
 
+// Whether our pawn on from can take en passant. The capture removes two
+// pieces from the board, which the pin and evasion masks can't describe,
+// so the resulting position is tested instead.
+static bool en_passant_legal (const MoveGenCache& genState, const Board& state, uint16_t from) {
+    uint16_t epSq = state.en_passant_sq;
+    uint16_t captured = epSq - 8;
+    uint64_t after = SET_BIT(CLEAR_BIT(CLEAR_BIT(genState.allPieces, from), captured), epSq);
+    return !enemy_attackers(state, CLEAR_BIT(genState.enemyPieces, captured), genState.kingSq, after);
+}
+
+// Legal targets for the piece of the given type on pos, using the
+// checkers and pins cached in genState.
+static uint64_t legal_move_mask (const MoveGenCache& genState, const Board& state, const Vec2& pos, PieceType type) {
+    uint64_t checkers = genState.checkers;
+    uint16_t kingSq = genState.kingSq;
+    uint64_t mask = pseudo_move_mask(state, genState.enemyPieces, pos, type);
+
+    if (type == PieceType::KING) {
+        uint64_t threats = genState.kingThreats;
+        uint64_t castles = mask & ~king_table[pos.idx];
+        uint64_t legal = mask & king_table[pos.idx] & ~threats;
+        // Can't castle out of or through check
+        if (castles && !checkers) {
+            if (CHECK_BIT(castles, 6) && !(threats & (BIT_MASK(5) | BIT_MASK(6)))) legal = SET_BIT(legal, 6);
+            if (CHECK_BIT(castles, 2) && !(threats & (BIT_MASK(3) | BIT_MASK(2)))) legal = SET_BIT(legal, 2);
+        }
+        return legal;
+    }
+
+    // In double check only the king can move
+    if (checkers & (checkers - 1)) return 0;
+
+    // Pins and evasions don't apply to en passant, it's checked on its own
+    uint64_t epMask = 0;
+    if (type == PieceType::PAWN && state.en_passant_sq && CHECK_BIT(mask, state.en_passant_sq)) {
+        if (en_passant_legal(genState, state, pos.idx)) epMask = BIT_MASK(state.en_passant_sq);
+        mask = CLEAR_BIT(mask, state.en_passant_sq);
+    }
+
+    if (checkers) mask &= between_table[kingSq][LSB_FIRST(checkers) - 1] | checkers;
+    if (CHECK_BIT(genState.pinned, pos.idx)) mask &= line_table[kingSq][pos.idx];
+    return mask | epMask;
+}
+
+// Legal pawn moves as sets. Unpinned pawns are done all at once, the
+// rare pinned ones one by one along their pin ray.
+static void legal_pawn_move_sets (MoveGenCache& genState, const Board& state) {
+    uint64_t pawns = state.pawns & state.current_bb;
+    uint64_t checkers = genState.checkers;
+    uint16_t kingSq = genState.kingSq;
+    // A pinned pawn can never answer a check
+    uint64_t pinned = checkers ? 0 : pawns & genState.pinned;
+    pawn_move_sets(genState, state, pawns & ~genState.pinned);
+    uint64_t enPassant = state.en_passant_sq ? pawn_attack_table[1][state.en_passant_sq] & pawns : 0;
+
+    if (checkers & (checkers - 1)) {
+        genState.pawnPushes = genState.pawnDoublePushes = 0;
+        genState.pawnCapturesWest = genState.pawnCapturesEast = 0;
+        genState.pawnEnPassant = 0;
+        return;
+    }
+    if (checkers) {
+        uint64_t evasions = between_table[kingSq][LSB_FIRST(checkers) - 1] | checkers;
+        genState.pawnPushes &= evasions;
+        genState.pawnDoublePushes &= evasions;
+        genState.pawnCapturesWest &= evasions;
+        genState.pawnCapturesEast &= evasions;
+    }
+
+    uint64_t empty = ~genState.allPieces;
+    uint16_t idx = 0;
+    MaskIterator iter{pinned};
+    while (iter.nextBit(&idx)) {
+        uint64_t ray = line_table[kingSq][idx];
+        uint64_t pawn = BIT_MASK(idx);
+        uint64_t push = (pawn << 8) & empty & ray;
+        genState.pawnPushes |= push;
+        genState.pawnDoublePushes |= ((push & rank_mask(2)) << 8) & empty & ray;
+        genState.pawnCapturesWest |= ((pawn & ~file_mask(0)) << 7) & genState.enemyPieces & ray;
+        genState.pawnCapturesEast |= ((pawn & ~file_mask(7)) << 9) & genState.enemyPieces & ray;
+    }
+
+    genState.pawnEnPassant = 0;
+    iter = MaskIterator{enPassant};
+    while (iter.nextBit(&idx)) {
+        if (en_passant_legal(genState, state, idx)) genState.pawnEnPassant = SET_BIT(genState.pawnEnPassant, idx);
+    }
+}
+
 void morphy::generateAllLegalMoves (MoveGenCache& genState, const Board& state) {
-    uint64_t moveCount = 0;
+    legal_pawn_move_sets(genState, state);
+    uint64_t moveCount = pawn_move_count(genState);
     for (const PieceType& t : all_piece_types) {
-        if (t == PieceType::NONE) continue;
+        if (t == PieceType::NONE || t == PieceType::PAWN) continue;
         MaskIterator mask{getPieceBoard(state,state.current_bb,t)};
         uint16_t idx = 0;
         while (mask.nextBit(&idx)) {
-            MoveIterator mi = generateMoveMask(genState, state, Vec2{idx}, t);
-            MoveIterator tmp = mi;
-            Move move;
-            while (tmp.nextMove(&move)) {
-                if (!validateMove(genState,state,move)) mi.clearMove(move.to);
-            }
+            MoveIterator mi{t, idx, {legal_move_mask(genState, state, Vec2{idx}, t)}};
             moveCount += mi.moveCount();
             genState.moves.emplace_back(mi);
         }
@@ -409,108 +807,306 @@ void morphy::generateAllLegalMoves (MoveGenCache& genState, const Board& state)
     genState.moveCount = moveCount;
 }
 
+void morphy::generateAllCaptures (MoveGenCache& genState, const Board& state) {
+    legal_pawn_move_sets(genState, state);
+    // Pushes only when they promote
+    genState.pawnPushes &= rank_mask(7);
+    genState.pawnDoublePushes = 0;
+    uint64_t moveCount = pawn_move_count(genState);
+    for (const PieceType& t : all_piece_types) {
+        if (t == PieceType::NONE || t == PieceType::PAWN) continue;
+        MaskIterator mask{getPieceBoard(state,state.current_bb,t)};
+        uint16_t idx = 0;
+        while (mask.nextBit(&idx)) {
+            MoveIterator mi{t, idx, {legal_move_mask(genState, state, Vec2{idx}, t) & genState.enemyPieces}};
+            if (!mi.hasMoves()) continue;
+            moveCount += mi.moveCount();
+            genState.moves.emplace_back(mi);
+        }
+    }
+    genState.moveCount = moveCount;
+}
+
+void morphy::generateAllQuiets (MoveGenCache& genState, const Board& state) {
+    legal_pawn_move_sets(genState, state);
+    // Everything generateAllCaptures yields is left out
+    genState.pawnPushes &= ~rank_mask(7);
+    genState.pawnCapturesWest = genState.pawnCapturesEast = 0;
+    genState.pawnEnPassant = 0;
+    uint64_t moveCount = pawn_move_count(genState);
+    for (const PieceType& t : all_piece_types) {
+        if (t == PieceType::NONE || t == PieceType::PAWN) continue;
+        MaskIterator mask{getPieceBoard(state,state.current_bb,t)};
+        uint16_t idx = 0;
+        while (mask.nextBit(&idx)) {
+            MoveIterator mi{t, idx, {legal_move_mask(genState, state, Vec2{idx}, t) & ~genState.enemyPieces}};
+            if (!mi.hasMoves()) continue;
+            moveCount += mi.moveCount();
+            genState.moves.emplace_back(mi);
+        }
+    }
+    genState.moveCount = moveCount;
+}
+
+uint64_t morphy::attackersTo (const Board& board, uint16_t sq, uint64_t occupied) {
+    uint64_t enemy = enemy_pieces(board);
+    // Our pawns attack north, so they reach sq from where an enemy pawn on sq would attack
+    return (pawn_attack_table[1][sq] & board.pawns & board.current_bb)
+         | (pawn_attack_table[0][sq] & board.pawns & enemy)
+         | (knight_table[sq] & board.knights)
+         | (king_table[sq] & board.kings)
+         | (bishop_attacks(sq, occupied) & (board.bishops | board.queens))
+         | (rook_attacks(sq, occupied) & (board.rooks | board.queens));
+}
+
+bool morphy::isSquareAttacked (const Board& board, uint16_t sq, uint64_t occupied) {
+    uint64_t enemy = enemy_pieces(board) & occupied;
+    if (pawn_attack_table[0][sq] & board.pawns & enemy) return true;
+    if (knight_table[sq] & board.knights & enemy) return true;
+    if (king_table[sq] & board.kings & enemy) return true;
+    uint64_t diagonal = (board.bishops | board.queens) & enemy;
+    if (diagonal && (bishop_attacks(sq, occupied) & diagonal)) return true;
+    uint64_t straight = (board.rooks | board.queens) & enemy;
+    return straight && (rook_attacks(sq, occupied) & straight);
+}
+
+uint64_t morphy::attackedSquares (const Board& board, uint64_t occupied) {
+    return enemy_attack_map(board, enemy_pieces(board) & occupied, occupied);
+}
+
 static uint8_t isCastleMove (const Move& move) {
     if (move.type != PieceType::KING) return NO_CASTLE;
-    else if (move.from == 3 && move.to == 1)  return CASTLE_KINGSIDE;
-    else if (move.from == 3 && move.to == 5) return CASTLE_QUEENSIDE;
+    else if (move.from == 4 && move.to == 6) return CASTLE_KINGSIDE;
+    else if (move.from == 4 && move.to == 2) return CASTLE_QUEENSIDE;
     else return NO_CASTLE;
 }
 
+static bool isEnPassantMove (const Board& state, const Move& move) {
+    return move.type == PieceType::PAWN
+        && state.en_passant_sq != 0
+        && move.to == state.en_passant_sq;
+}
+
 bool morphy::validateMove (const MoveGenCache& genState, const Board& state, const Move& move) {
-    uint64_t allPieces = genState.allPieces;
     if (!CHECK_BIT(state.current_bb,move.from)) return false;
+    if (!cellOccupiedByType(state, move.type, move.from)) return false;
+    return CHECK_BIT(legal_move_mask(genState, state, Vec2{move.from}, move.type), move.to);
+}
 
-    uint8_t castle = isCastleMove(move);
-    if (castle) {
-        if (!state.current_castle_flags) return false;
+void morphy::applyMove (Board& state, const Move& move) {
+    uint64_t enemy = enemy_pieces(state);
+    state.hash ^= castle_key(state) ^ en_passant_key(state);
+    bool irreversible = move.type == PieceType::PAWN || CHECK_BIT(enemy, move.to);
+    state.halfmove_clock = irreversible ? 0 : state.halfmove_clock + 1;
+    if (!state.is_white) state.fullmove_number++;
+    if (CHECK_BIT(enemy, move.to)) {
+        clearPiece(state, getPieceTypeAtCell(state, move.to), move.to);
+        // Capturing a rook on its home square takes away the opponent's right
+        if (move.to == 56) state.other_castle_flags &= ~CASTLE_QUEENSIDE;
+        else if (move.to == 63) state.other_castle_flags &= ~CASTLE_KINGSIDE;
+    }
+    else if (isEnPassantMove(state, move)) {
+        clearPiece(state, PieceType::PAWN, move.to - 8);
+    }
+    state.en_passant_sq = 0;
+
+    clearPiece(state, move.type, move.from);
+    state.current_bb = MOVE_BIT(state.current_bb, move.from, move.to);
+    if (move.promotion != PieceType::NONE) {
+        setPiece(state, move.promotion, move.to);
+    }
+    else {
+        setPiece(state, move.type, move.to);
+        if (move.type == PieceType::PAWN && move.to >= 56) {
+            state.promotion_needed = true;
+            state.promotion_sq = move.to;
+        }
+    }
+
+    switch (move.type) {
+    case PieceType::KING: {
+        uint8_t castle = isCastleMove(move);
         if (castle == CASTLE_KINGSIDE) {
-            if (allPieces & 6) return false; // path to rook isn't clear
-            if (threatsToCells(std::move(genState),state,{{2,0},{1,0}}).size()) return false;
+            clearPiece(state, PieceType::ROOK, 7);
+            state.current_bb = MOVE_BIT(state.current_bb, 7, 5);
+            setPiece(state, PieceType::ROOK, 5);
         }
         else if (castle == CASTLE_QUEENSIDE) {
-            if (allPieces & 112) return false; // path to rook isn't clear
-            if (threatsToCells(std::move(genState),state,{{2,0},{1,0},{4,0},{5,0},{6,0}}).size()) return false;
+            clearPiece(state, PieceType::ROOK, 0);
+            state.current_bb = MOVE_BIT(state.current_bb, 0, 3);
+            setPiece(state, PieceType::ROOK, 3);
         }
+        state.current_castle_flags = NO_CASTLE;
+        break;
     }
-
-    // Handle double pawn move
-    if (move.type == PieceType::PAWN && (move.to - move.from) == 16){
-        if (move.from < 8 && move.from > 15) return false; // piece has already moved
-        if ((BIT_MASK(move.from + 8)) & genState.allPieces) return false; // blocked by another piece
+    case PieceType::ROOK:
+        if (move.from == 0) state.current_castle_flags &= ~CASTLE_QUEENSIDE;
+        else if (move.from == 7) state.current_castle_flags &= ~CASTLE_KINGSIDE;
+        break;
+    case PieceType::PAWN:
+        // Only record the en passant square if an enemy pawn can use it
+        if (move.to - move.from == 16 && (pawn_attack_table[0][move.from + 8] & enemy & state.pawns)) {
+            state.en_passant_sq = move.from + 8;
+        }
+        break;
+    default:
+        break;
     }
-
-    return true;
+    state.hash ^= castle_key(state) ^ en_passant_key(state);
 }
 
-void morphy::applyMove (Board& state, const Move& move) {
-    state.current_bb = MOVE_BIT(state.current_bb, move.from, move.to);
-    for (const PieceType& t : all_piece_types) {
-        if (t == PieceType::NONE) continue;
-        if (t == move.type) continue;
-        uint64_t * bb = getPieceBoard(state, t);
-        *bb = CLEAR_BIT(*bb, move.to);
-    }
+void morphy::makeMove (Board& state, const Move& move, UndoRecord& undo) {
+    undo.captured = PieceType::NONE;
+    if (CHECK_BIT(enemy_pieces(state), move.to)) undo.captured = getPieceTypeAtCell(state, move.to);
+    else if (isEnPassantMove(state, move)) undo.captured = PieceType::PAWN;
+    undo.en_passant_sq = state.en_passant_sq;
+    undo.current_castle_flags = state.current_castle_flags;
+    undo.other_castle_flags = state.other_castle_flags;
+    undo.halfmove_clock = state.halfmove_clock;
+    undo.hash = state.hash;
+    undo.pawn_hash = state.pawn_hash;
+
+    applyMove(state, move);
+    flipBoard(state);
+}
 
-    if (move.type == PieceType::PAWN && move.to >= 56) {
-        state.promotion_needed = true;
-        state.promotion_sq = move.to;
-    }
+void morphy::unmakeMove (Board& state, const Move& move, const UndoRecord& undo) {
+    flipBoard(state);
+    state.en_passant_sq = undo.en_passant_sq;
+    state.current_castle_flags = undo.current_castle_flags;
+    state.other_castle_flags = undo.other_castle_flags;
+    state.halfmove_clock = undo.halfmove_clock;
+    if (!state.is_white) state.fullmove_number--;
+    state.promotion_needed = false;
 
-    uint64_t * bb = getPieceBoard(state, move.type);
-    *bb = MOVE_BIT(*bb, move.from, move.to);
+    PieceType placed = move.promotion != PieceType::NONE ? move.promotion : move.type;
+    clearPiece(state, placed, move.to);
+    state.current_bb = MOVE_BIT(state.current_bb, move.to, move.from);
+    setPiece(state, move.type, move.from);
 
     uint8_t castle = isCastleMove(move);
     if (castle == CASTLE_KINGSIDE) {
-        uint64_t* cb = getPieceBoard(state,PieceType::ROOK);
-        *cb = MOVE_BIT(*cb, 0, 2);
+        clearPiece(state, PieceType::ROOK, 5);
+        state.current_bb = MOVE_BIT(state.current_bb, 5, 7);
+        setPiece(state, PieceType::ROOK, 7);
     }
     else if (castle == CASTLE_QUEENSIDE) {
-        uint64_t* cb = getPieceBoard(state,PieceType::ROOK);
-        *cb = MOVE_BIT(*cb, 7, 5);
+        clearPiece(state, PieceType::ROOK, 3);
+        state.current_bb = MOVE_BIT(state.current_bb, 3, 0);
+        setPiece(state, PieceType::ROOK, 0);
+    }
+
+    // The captured piece isn't in current_bb, so it comes back as an enemy piece
+    if (undo.captured != PieceType::NONE) {
+        bool enPassant = move.type == PieceType::PAWN && move.to == undo.en_passant_sq;
+        setPiece(state, undo.captured, enPassant ? move.to - 8 : move.to);
     }
+    state.hash = undo.hash;
+    state.pawn_hash = undo.pawn_hash;
 }
 
-// Determines where a cell is being attacked from.
-std::vector<Move> morphy::threatsToCells (const MoveGenCache& genState, const Board& board, const std::initializer_list<Vec2>& positions){
-    std::vector<Move> res;
-    uint64_t enemy = genState.enemyPieces;
-    uint64_t own = board.current_bb;
+void morphy::makeNullMove (Board& state, UndoRecord& undo) {
+    undo.en_passant_sq = state.en_passant_sq;
+    undo.hash = state.hash;
+    state.hash ^= en_passant_key(state);
+    state.en_passant_sq = 0;
+    flipBoard(state);
+}
 
-    for (const auto& p : positions){
-        uint16_t idx = 0;
-        uint16_t posIdx = static_cast<uint16_t>(p.idx);
+void morphy::unmakeNullMove (Board& state, const UndoRecord& undo) {
+    flipBoard(state);
+    state.en_passant_sq = undo.en_passant_sq;
+    state.hash = undo.hash;
+}
 
-        for (const PieceType& t : all_piece_types) {
-            if (t == PieceType::NONE) continue;
-            if (t == PieceType::KING || t == PieceType::KNIGHT || t == PieceType::PAWN) continue;
+static const std::array<PieceType,4> promotion_types{
+    {PieceType::KNIGHT, PieceType::BISHOP, PieceType::ROOK, PieceType::QUEEN}
+};
+
+static uint16_t moveFlags (const Board& state, uint64_t enemy, const Move& move) {
+    if (move.type == PieceType::PAWN) {
+        if (isEnPassantMove(state, move)) return EN_PASSANT;
+        if (move.to - move.from == 16) return DOUBLE_PUSH;
+    }
+    else if (move.type == PieceType::KING) {
+        uint8_t castle = isCastleMove(move);
+        if (castle == CASTLE_KINGSIDE) return KING_CASTLE;
+        if (castle == CASTLE_QUEENSIDE) return QUEEN_CASTLE;
+    }
+    return CHECK_BIT(enemy, move.to) ? CAPTURE : QUIET;
+}
+
+PackedMove morphy::packMove (const Board& state, const Move& move) {
+    uint16_t flags = moveFlags(state, enemy_pieces(state), move);
+    for (uint16_t i = 0; i < promotion_types.size(); i++) {
+        if (promotion_types[i] == move.promotion) flags |= PROMOTION | i;
+    }
+    return {move.from, move.to, flags};
+}
 
-            uint64_t mask = 0;
-            if (t == PieceType::ROOK) mask = rook_mask(own,enemy,p);
-            else if (t == PieceType::BISHOP) mask = bishop_mask(own,enemy,p);
-            else if (t == PieceType::QUEEN) mask = queen_mask(own,enemy,p);
+Move morphy::unpackMove (const Board& state, PackedMove move) {
+    Move res{getPieceTypeAtCell(state, move.from()), move.from(), move.to()};
+    if (move.isPromotion()) res.promotion = promotion_types[move.flags() & 3];
+    return res;
+}
 
-            uint64_t bb = getPieceBoard(board,enemy,t);
-            MaskIterator p{mask & bb};
-            while (p.nextBit(&idx)){
-                res.emplace_back(t,idx,posIdx);
+// Pawn targets in set become moves from to - offset, four of them
+// when the pawn promotes
+static void serialize_pawn_set (uint64_t set, int offset, uint16_t flags, MoveList& list) {
+    while (set) {
+        uint16_t to = LSB_FIRST(set) - 1;
+        uint16_t from = to - offset;
+        set &= set - 1;
+        if (to >= 56) {
+            // Queen first, it's almost always the one we want
+            for (uint16_t i = promotion_types.size(); i-- > 0;) {
+                list.emplace_back(from, to, flags | PROMOTION | i);
             }
         }
+        else {
+            list.emplace_back(from, to, flags);
+        }
+    }
+}
 
-        MaskIterator pi{ pawn_mask(own,enemy,p) & getPieceBoard(board,enemy,PieceType::PAWN) };
-        while (pi.nextBit(&idx)) { res.emplace_back(PieceType::PAWN, idx, posIdx); }
+void morphy::serializeMoves (const MoveGenCache& genState, const Board& state, MoveList& list) {
+    serialize_pawn_set(genState.pawnCapturesWest, 7, CAPTURE, list);
+    serialize_pawn_set(genState.pawnCapturesEast, 9, CAPTURE, list);
+    serialize_pawn_set(genState.pawnPushes, 8, QUIET, list);
+    serialize_pawn_set(genState.pawnDoublePushes, 16, DOUBLE_PUSH, list);
+    uint16_t idx = 0;
+    MaskIterator ep{genState.pawnEnPassant};
+    while (ep.nextBit(&idx)) list.emplace_back(idx, state.en_passant_sq, EN_PASSANT);
+
+    for (const MoveIterator& mi : genState.moves) {
+        MoveIterator iter = mi;
+        Move move;
+        // Pawns are only in the sets above, so no promotions here
+        while (iter.nextMove(&move)) list.emplace_back(move.from, move.to, moveFlags(state, genState.enemyPieces, move));
+    }
+}
 
-        MaskIterator ni{ knight_mask(own,enemy,p) & getPieceBoard(board,enemy,PieceType::KNIGHT) };
-        while (ni.nextBit(&idx)) { res.emplace_back(PieceType::KNIGHT, idx, posIdx); }
+// Determines where a cell is being attacked from.
+ThreatList morphy::threatsToCells (const MoveGenCache& genState, const Board& board, const std::initializer_list<Vec2>& positions){
+    ThreatList res;
+    uint64_t enemy = genState.enemyPieces;
 
-        uint64_t km = king_mask(own,enemy,p)  & getPieceBoard(board,enemy, PieceType::KING);
-        if (km) {
-            res.emplace_back(PieceType::KING, km, posIdx);
+    for (const auto& p : positions){
+        // Each cell can't have more threats than there are enemy pieces
+        if (res.size() + MAX_PIECES > res.capacity()) break;
+        uint16_t posIdx = static_cast<uint16_t>(p.idx);
+        uint64_t attackers = attackersTo(board, posIdx, genState.allPieces) & enemy;
+        for (const PieceType& t : all_piece_types) {
+            if (t == PieceType::NONE) continue;
+            uint16_t idx = 0;
+            MaskIterator iter{attackers & *getPieceBoard(board, t)};
+            while (iter.nextBit(&idx)) res.emplace_back(t, idx, posIdx);
         }
     }
     return res;
 }
 
-std::vector<Move> morphy::threatsToCell (const MoveGenCache& genState, const Board& board, const Vec2& pos) {
+ThreatList morphy::threatsToCell (const MoveGenCache& genState, const Board& board, const Vec2& pos) {
     return threatsToCells(genState,board,{pos});
 }
 
@@ -0,0 +1,253 @@
+// Consistency checks run by ctest. Most replay random games from a fixed
+// seed and compare state kept up to date incrementally with the same
+// state computed from scratch.
+#include <cstring>
+#include <iterator>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <morphy/bench.h>
+#include <morphy/board.h>
+#include <morphy/eval.h>
+#include <morphy/fen.h>
+#include <morphy/nnue.h>
+#include <morphy/uci.h>
+
+using namespace morphy;
+
+static const uint32_t SEED = 20240601;
+static const int GAMES = 40;
+static const int MAX_GAME_PLIES = 200;
+
+static void usage () {
+    std::cerr << "usage: morphy_check (keys | fen | nnue FILE)\n"
+              << "  keys  Zobrist keys and piece-square sums against a recompute over\n"
+              << "        random make/unmake and null moves from the bench positions\n"
+              << "  fen   FEN round trips over the bench positions and random games from\n"
+              << "        them, and the errors reported for bad input\n"
+              << "  nnue  incremental accumulators against a refresh, and evaluate\n"
+              << "        with every SIMD level the CPU supports, for the network in FILE\n";
+}
+
+// A random legal move, false if there isn't one
+static bool random_move (const Board& board, std::mt19937& rng, Move& move) {
+    MoveGenCache genState(board);
+    generateAllLegalMoves(genState, board);
+    MoveList moves;
+    serializeMoves(genState, board, moves);
+    if (moves.empty()) return false;
+    move = unpackMove(board, moves[rng() % moves.size()]);
+    return true;
+}
+
+// Calls visit with every position of the seeded random games played
+// from each bench position, the start positions included.
+template <class Visit>
+static void replay_bench_games (Visit visit) {
+    std::mt19937 rng(SEED);
+    for (const char* fen : benchPositions()) {
+        Board board;
+        fen::fen_to_board(board, fen);
+        visit(board);
+        Move move;
+        for (int ply = 0; ply < MAX_GAME_PLIES / 4 && random_move(board, rng, move); ply++) {
+            UndoRecord undo;
+            makeMove(board, move, undo);
+            visit(board);
+        }
+    }
+}
+
+// Keys and sums computed from scratch for board
+static bool same_keys (const Board& board) {
+    Board fresh = board;
+    refreshPieceSquare(fresh);
+    return board.hash == zobristHash(board) && board.pawn_hash == zobristPawnHash(board) &&
+           board.psq_mg == fresh.psq_mg && board.psq_eg == fresh.psq_eg && board.phase == fresh.phase;
+}
+
+static bool same_board (const Board& a, const Board& b) {
+    return a.rooks == b.rooks && a.bishops == b.bishops && a.knights == b.knights &&
+           a.queens == b.queens && a.kings == b.kings && a.pawns == b.pawns &&
+           a.current_bb == b.current_bb && a.is_white == b.is_white &&
+           a.en_passant_sq == b.en_passant_sq && a.current_castle_flags == b.current_castle_flags &&
+           a.other_castle_flags == b.other_castle_flags && a.halfmove_clock == b.halfmove_clock &&
+           a.fullmove_number == b.fullmove_number && a.hash == b.hash && a.pawn_hash == b.pawn_hash &&
+           a.psq_mg == b.psq_mg && a.psq_eg == b.psq_eg && a.phase == b.phase;
+}
+
+static bool check_keys () {
+    std::mt19937 rng(SEED);
+    uint64_t plies = 0;
+    uint64_t failures = 0;
+    for (const char* fen : benchPositions()) {
+        Board board;
+        fen::fen_to_board(board, fen);
+        Move move;
+        for (int ply = 0; ply < MAX_GAME_PLIES && random_move(board, rng, move); ply++) {
+            Board before = board;
+            UndoRecord undo;
+            makeMove(board, move, undo);
+            plies++;
+            if (!same_keys(board)) {
+                std::cout << "keys differ after " << uci::moveToString(move, before.is_white)
+                          << " from " << fen::board_to_fen(before) << "\n";
+                failures++;
+            }
+            // Every so often take it back and check nothing is left behind
+            if (rng() % 4 == 0) {
+                unmakeMove(board, move, undo);
+                if (!same_board(board, before)) {
+                    std::cout << "unmake of " << uci::moveToString(move, before.is_white)
+                              << " doesn't restore " << fen::board_to_fen(before) << "\n";
+                    failures++;
+                }
+                makeMove(board, move, undo);
+            }
+            if (rng() % 8 == 0 && !MoveGenCache(board).checkers) {
+                Board beforeNull = board;
+                UndoRecord nullUndo;
+                makeNullMove(board, nullUndo);
+                if (!same_keys(board)) {
+                    std::cout << "keys differ after a null move from " << fen::board_to_fen(beforeNull) << "\n";
+                    failures++;
+                }
+                unmakeNullMove(board, nullUndo);
+                if (!same_board(board, beforeNull)) {
+                    std::cout << "null move isn't undone in " << fen::board_to_fen(beforeNull) << "\n";
+                    failures++;
+                }
+            }
+        }
+    }
+    std::cout << plies << " plies, " << failures << " failures\n";
+    return failures == 0;
+}
+
+struct BadFEN {
+    const char* fen;
+    const char* error;
+    size_t offset;
+};
+
+static const BadFEN bad_fens[] = {
+    {"rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "empty square count isn't 1 to 8", 18},
+    {"rnbqkbnr/ppppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "rank doesn't have eight squares", 17},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP w KQkq - 0 1", "placement doesn't have eight ranks", 34},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNX w KQkq - 0 1", "unknown piece letter", 42},
+    {"8/8/8/8/8/8/8/K7 w - - 0 1", "each side needs one king", 0},
+    {"k7/8/8/8/8/8/8/KP6 w - - 0 1", "pawn on the first or last rank", 0},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1", "side to move isn't w or b", 44},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQxq - 0 1", "unknown castling right", 48},
+    {"rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq e3 0 2", "bad en passant square", 55},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0x 1", "bad halfmove clock", 53},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq", "missing en passant field", 50},
+};
+
+static bool check_fen () {
+    uint64_t failures = 0;
+    for (const char* fen : benchPositions()) {
+        Board board;
+        fen::ParseResult res = fen::fen_to_board(board, fen);
+        if (!res || fen::board_to_fen(board) != fen) {
+            std::cout << "round trip failed: " << fen << "\n";
+            failures++;
+        }
+    }
+
+    uint64_t positions = 0;
+    replay_bench_games([&] (const Board& board) {
+        std::string fen = fen::board_to_fen(board);
+        Board parsed;
+        positions++;
+        if (!fen::fen_to_board(parsed, fen) || parsed.hash != board.hash || parsed.pawn_hash != board.pawn_hash ||
+            parsed.is_white != board.is_white || parsed.halfmove_clock != board.halfmove_clock ||
+            parsed.fullmove_number != board.fullmove_number || fen::board_to_fen(parsed) != fen) {
+            std::cout << "played position doesn't round trip: " << fen << "\n";
+            failures++;
+        }
+    });
+
+    for (const BadFEN& bad : bad_fens) {
+        Board board;
+        fen::ParseResult res = fen::fen_to_board(board, bad.fen);
+        if (!res.error || strcmp(res.error, bad.error) || res.offset != bad.offset) {
+            std::cout << bad.fen << ": expected \"" << bad.error << "\" at " << bad.offset << ", got \""
+                      << (res.error ? res.error : "no error") << "\" at " << res.offset << "\n";
+            failures++;
+        }
+    }
+
+    std::cout << benchPositions().size() << " bench fens, " << positions << " played positions, "
+              << std::size(bad_fens) << " bad fens, " << failures << " failures\n";
+    return failures == 0;
+}
+
+static bool same_accumulator (const nnue::Network& net, const nnue::Accumulator& a, const nnue::Accumulator& b) {
+    for (int side = 0; side < 2; side++) {
+        if (memcmp(a.values[side].data(), b.values[side].data(), net.hidden * sizeof(int16_t))) return false;
+    }
+    return true;
+}
+
+// Plays the seeded games with the kernels of one SIMD level, appending
+// the evaluation of every position to evals. Returns the number of
+// plies where the updated accumulator differs from a refresh.
+static uint64_t replay_nnue (const nnue::Network& net, std::vector<int>& evals, uint64_t& plies) {
+    std::mt19937 rng(SEED);
+    uint64_t mismatches = 0;
+    for (int game = 0; game < GAMES; game++) {
+        Board board;
+        initializeBoard(board);
+        nnue::Accumulator acc, next, fresh;
+        nnue::refresh(net, board, acc);
+        Move move;
+        for (int ply = 0; ply < MAX_GAME_PLIES && random_move(board, rng, move); ply++) {
+            nnue::update(net, board, move, acc, next);
+            UndoRecord undo;
+            makeMove(board, move, undo);
+            nnue::refresh(net, board, fresh);
+            if (!same_accumulator(net, next, fresh)) mismatches++;
+            evals.push_back(nnue::evaluate(net, board, next));
+            acc = next;
+            plies++;
+        }
+    }
+    return mismatches;
+}
+
+static bool check_nnue (const std::string& path) {
+    nnue::Network net;
+    std::string error;
+    if (!nnue::loadNetwork(net, path, error)) {
+        std::cout << "can't load " << path << ": " << error << "\n";
+        return false;
+    }
+
+    bool ok = true;
+    std::vector<int> reference;
+    for (nnue::Simd simd : {nnue::Simd::SCALAR, nnue::Simd::SSE41, nnue::Simd::AVX2}) {
+        nnue::setSimd(simd);
+        if (nnue::activeSimd() != simd) continue;   // not supported here
+        std::vector<int> evals;
+        uint64_t plies = 0;
+        uint64_t mismatches = replay_nnue(net, evals, plies);
+        bool sameEval = simd == nnue::Simd::SCALAR || evals == reference;
+        if (simd == nnue::Simd::SCALAR) reference = evals;
+        std::cout << nnue::simdName(simd) << ": " << plies << " plies, " << mismatches
+                  << " update mismatches, evaluate " << (sameEval ? "matches" : "differs from") << " scalar\n";
+        ok = ok && mismatches == 0 && sameEval;
+    }
+    nnue::setSimd(nnue::detectSimd());
+    return ok;
+}
+
+int main (int argc, char** argv) {
+    if (argc == 2 && !strcmp(argv[1], "keys")) return check_keys() ? 0 : 1;
+    if (argc == 2 && !strcmp(argv[1], "fen")) return check_fen() ? 0 : 1;
+    if (argc == 3 && !strcmp(argv[1], "nnue")) return check_nnue(argv[2]) ? 0 : 1;
+    usage();
+    return 2;
+}
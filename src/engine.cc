@@ -1,95 +1,204 @@
 #include <morphy/engine.h>
-#include <random>
+#include <morphy/bench.h>
+#include <morphy/eval.h>
+#include <morphy/fen.h>
+#include <morphy/search.h>
+#include <morphy/timeman.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
 
 using namespace morphy;
 
-static uint64_t popcount64(uint64_t x) {
-    x = (x & 0x5555555555555555ULL) + ((x >> 1) & 0x5555555555555555ULL);
-    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
-    x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL);
-    return (x * 0x0101010101010101ULL) >> 56;
+int EngineConfig::pieceValue(PieceType type) const {
+    return piece_values[static_cast<uint8_t>(type)];
 }
 
-static int roll(int min, int max) {
-   double x = rand()/static_cast<double>(RAND_MAX);
-   int that = min + static_cast<int>( x * (max - min) );
-   return that;
+int morphy::scorePieces (const EngineConfig& config, const Board& state, uint64_t mask) {
+    return __builtin_popcountll(state.pawns & mask) * config.pieceValue(PieceType::PAWN) +
+           __builtin_popcountll(state.bishops & mask) * config.pieceValue(PieceType::BISHOP) +
+           __builtin_popcountll(state.knights & mask) * config.pieceValue(PieceType::KNIGHT) +
+           __builtin_popcountll(state.rooks & mask) * config.pieceValue(PieceType::ROOK) +
+           __builtin_popcountll(state.queens & mask) * config.pieceValue(PieceType::QUEEN);
 }
 
-int EngineConfig::pieceValue(PieceType type) const {
-    return piece_values[static_cast<uint8_t>(type)];
+int morphy::scoreBoard ([[maybe_unused]] const EngineConfig& config, const Board& state) {
+    return classicalEval(state);
 }
 
-int morphy::scorePieces (const EngineConfig& config, const Board& state, uint64_t mask) {
-    return popcount64(state.pawns & mask) * config.pieceValue(PieceType::PAWN) +
-           popcount64(state.bishops & mask) * config.pieceValue(PieceType::BISHOP) +
-           popcount64(state.knights & mask) * config.pieceValue(PieceType::KNIGHT) +
-           popcount64(state.rooks & mask) * config.pieceValue(PieceType::ROOK) +
-           popcount64(state.queens & mask) * config.pieceValue(PieceType::QUEEN);
-}
-
-int morphy::scoreBoard (const EngineConfig& config, const Board& state) {
-    return roll(-100,100);
-}
-
-Move morphy::findBestMove (const EngineConfig& config, MoveGenCache& genState, const Board& state){
-    Move best;
-    Move currentMove;
-    int bestScore = std::numeric_limits<int>::min();
-    for (auto& mi : genState.moves) {
-        while (mi.nextMove(&currentMove)) {
-            Board tmp = state;
-            applyMove(tmp, currentMove);
-            int score = -scoreBoard(config, tmp);
-            if (score > bestScore) {
-                bestScore = score;
-                best = currentMove;
-            }
+int morphy::staticExchange (const EngineConfig& config, const Board& state, const Move& move) {
+    // Least valuable first
+    static const PieceType order[] = {
+        PieceType::PAWN, PieceType::KNIGHT, PieceType::BISHOP,
+        PieceType::ROOK, PieceType::QUEEN, PieceType::KING
+    };
+
+    uint64_t occupied = all_pieces(state);
+    uint64_t sides[2] = {state.current_bb, occupied & ~state.current_bb};
+    int gain[32];
+    int d = 0;
+
+    PieceType captured = getPieceTypeAtCell(state, move.to);
+    gain[0] = captured == PieceType::NONE ? 0 : config.pieceValue(captured);
+    if (move.type == PieceType::PAWN && state.en_passant_sq && move.to == state.en_passant_sq) {
+        gain[0] = config.pieceValue(PieceType::PAWN);
+        occupied &= ~(1ULL << (move.to - 8));
+    }
+    PieceType onSquare = move.type;
+    if (move.promotion != PieceType::NONE) {
+        gain[0] += config.pieceValue(move.promotion) - config.pieceValue(PieceType::PAWN);
+        onSquare = move.promotion;
+    }
+
+    occupied &= ~(1ULL << move.from);
+    uint64_t attackers = attackersTo(state, move.to, occupied) & occupied;
+    int side = 1;
+    while (d < 31) {
+        uint64_t own = attackers & sides[side];
+        if (!own) break;
+
+        PieceType next = PieceType::NONE;
+        uint64_t from = 0;
+        for (PieceType t : order) {
+            from = own & *getPieceBoard(state, t);
+            if (from) { next = t; break; }
         }
+        // The king can only recapture if the square isn't defended
+        if (next == PieceType::KING && (attackers & sides[side ^ 1])) break;
+
+        d++;
+        gain[d] = config.pieceValue(onSquare) - gain[d - 1];
+        onSquare = next;
+        occupied &= ~(from & -from);
+        attackers = attackersTo(state, move.to, occupied) & occupied;
+        side ^= 1;
     }
-    return best;
+
+    // Either side may stop recapturing when it would lose material
+    while (d > 0) {
+        gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+        d--;
+    }
+    return gain[0];
+}
+
+// Out of line so ThreadTables is complete where the vector is destroyed
+Engine::Engine () :
+    Engine(DEFAULT_ENGINE_CONFIG)
+{}
+
+Engine::Engine (const EngineConfig& config) :
+    _tt(config.hashSize),
+    config(config)
+{
+    restart();
 }
 
+Engine::~Engine () {}
+
 void Engine::clearState () {
-    while (!_states.empty()) _states.pop();
+    _history.clear();
+    _lastSearch = MoveGenState{};
 }
 
 Board& Engine::getState () {
-    return _states.top();
+    return _board;
 }
 
 void Engine::restart() {
     clearState();
-    Board state;
-    initializeBoard(state);
-    _states.push(state);
-    _genState = MoveGenCache{state};
+    _board = Board{};
+    initializeBoard(_board);
+}
+
+void Engine::newGame () {
+    restart();
+    _tt.clear();
+    for (auto& tables : _threadTables) tables->clear();
+}
+
+bool Engine::setHashSize (size_t megabytes) {
+    try {
+        _tt.resize(megabytes);
+    }
+    catch (const std::bad_alloc&) {
+        return false;
+    }
+    config.hashSize = megabytes;
+    return true;
+}
+
+void Engine::setThreadCount (int count) {
+    config.theadCount = count;
+}
+
+void Engine::updateEvaluator () {
+    config.network = _useNetwork && _network.loaded() ? &_network : nullptr;
+}
+
+bool Engine::loadNetwork (const std::string& path, std::string& error) {
+    if (!nnue::loadNetwork(_network, path, error)) return false;
+    updateEvaluator();
+    return true;
+}
+
+void Engine::setUseNetwork (bool enabled) {
+    _useNetwork = enabled;
+    updateEvaluator();
+}
+
+bool Engine::usingNetwork () const {
+    return config.network != nullptr;
+}
+
+void Engine::stop () {
+    _stop.store(true);
+}
+
+bool Engine::stopRequested () const {
+    return _stop.load();
+}
+
+void Engine::clearStop () {
+    _stop.store(false);
 }
 
 void Engine::setBoard(const Board& board) {
     clearState();
-    _states.emplace(board);
-    _genState = MoveGenCache{board};
+    _board = board;
 }
 
 void Engine::makeMove (const Move& move) {
-    Board newState = getState();
-    ::applyMove(newState, move);
-    //flipBoard(newState);
-    _genState = MoveGenCache{newState};
-    _states.emplace(newState);
+    _history.emplace_back(move, UndoRecord{});
+    morphy::makeMove(_board, move, _history.back().second);
 }
 
 Move Engine::makeMove() {
-    generateAllLegalMoves(_genState, getState());
-    Move m = findBestMove(config, _genState, getState());
-    makeMove(m);
+    return makeMove({config.searchDepth, 0, DEFAULT_MOVE_TIME, DEFAULT_MOVE_TIME});
+}
+
+Move Engine::makeMove (const SearchLimits& limits, const SearchCallback& onIteration) {
+    Move m = findBestMove(limits, onIteration);
+    if (m.type != PieceType::NONE) makeMove(m);
     return m;
 }
 
+Move Engine::findBestMove (const SearchLimits& limits, const SearchCallback& onIteration) {
+    std::vector<uint64_t> hashes;
+    hashes.reserve(_history.size());
+    for (const auto& entry : _history) hashes.push_back(entry.second.hash);
+    return searchBestMove(config, limits, _board, _tt, _threadTables, hashes, _stop, _lastSearch, onIteration);
+}
+
+const MoveGenState& Engine::lastSearch () const {
+    return _lastSearch;
+}
+
 void Engine::undoMove() {
-    _states.pop();
-    _genState = MoveGenCache{_states.top()};
+    if (_history.empty()) return;
+    const auto& [move, undo] = _history.back();
+    morphy::unmakeMove(_board, move, undo);
+    _history.pop_back();
 }
 
 UCIAdaptor::UCIAdaptor (Engine& engine, uci::IOPipe& pipe) :
@@ -98,40 +207,158 @@ UCIAdaptor::UCIAdaptor (Engine& engine, uci::IOPipe& pipe) :
     _isRunning(true)
 {}
 
+UCIAdaptor::~UCIAdaptor () {
+    stopSearch();
+}
+
+void UCIAdaptor::startSearch (const std::vector<std::string>& message) {
+    waitForSearch();
+    uci::GoCommand go;
+    if (!uci::parseGo(message, go)) {
+        std::lock_guard<std::mutex> lock(_ioLock);
+        uci::logMessage(_io, "Invalid go command, searching with what could be parsed");
+    }
+    bool white = _engine.getState().is_white;
+    SearchLimits limits = allocateTime(go, white, _engine.config.searchDepth);
+
+    // Cleared here rather than on the worker so a stop sent right after
+    // go can't be lost
+    _engine.clearStop();
+    _searchThread = std::thread([this, limits, white, infinite = go.infinite] () {
+        Move m = _engine.findBestMove(limits, [&] (const MoveGenState& info) {
+            std::lock_guard<std::mutex> lock(_ioLock);
+            uci::moveGenInfo(_io, info, white);
+        });
+        // In infinite mode bestmove may only be sent after stop
+        while (infinite && !_engine.stopRequested()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        std::lock_guard<std::mutex> lock(_ioLock);
+        // Mated or stalemated, UCI's null move rather than a1a1
+        if (m.type == PieceType::NONE) _io << "bestmove 0000\n";
+        else uci::signalBestMove(_io, {m.type, relativeSquare(white, m.from), relativeSquare(white, m.to), m.promotion});
+    });
+}
+
+void UCIAdaptor::stopSearch () {
+    _engine.stop();
+    waitForSearch();
+}
+
+void UCIAdaptor::waitForSearch () {
+    if (_searchThread.joinable()) _searchThread.join();
+}
+
 void UCIAdaptor::handleUCIMessage (const std::vector<std::string>& message) {
-    if (message[0] == "isready") uci::signalReady(_io);
-    else if (message[0] == "uci") {
+    if (message[0] == "isready") {
+        std::lock_guard<std::mutex> lock(_ioLock);
+        uci::signalReady(_io);
+        return;
+    }
+    if (message[0] == "stop") {
+        _engine.stop();
+        return;
+    }
+    if (message[0] == "quit") {
+        stopSearch();
+        _isRunning = false;
+        return;
+    }
+    if (message[0] == "go") {
+        startSearch(message);
+        return;
+    }
+
+    // Everything else reads or changes the engine, which the GUI shouldn't
+    // do mid-search. Let the search finish rather than race it.
+    waitForSearch();
+    std::lock_guard<std::mutex> lock(_ioLock);
+    if (message[0] == "uci") {
         uci::UCIConfigurator()
                 .setEngineName("Morphy")
                 .setAuthorName("danem")
-                .setHashRange(1, 128)
+                .setHashRange(1, MAX_HASH_SIZE, _engine.config.hashSize)
+                .setThreadRange(1, MAX_THREADS, _engine.config.theadCount)
+                .setEvalFile("", false)
                 .setELORange(1,20)
                 .build(_io);
     }
-    else if (message[0] == "ucinewgame") _engine.restart();
-    else if (message[0] == "quit") _isRunning = false;
-    else if (message[0] == "go") {
-        Move m = _engine.makeMove();
-        uci::signalBestMove(_io, m);
+    else if (message[0] == "ucinewgame") _engine.newGame();
+    else if (message[0] == "bench") {
+        // Not part of UCI. Runs on its own engine so the game's table and
+        // position are left alone.
+        BenchConfig bench = DEFAULT_BENCH_CONFIG;
+        if (!parseBench(message, bench)) uci::logMessage(_io, "Invalid bench command, usage: bench [hash] [threads] [depth]");
+        else runBench(bench, _engine.config, _io);
+    }
+    else if (message[0] == "setoption") {
+        // setoption name <id> [value <x>], names may contain spaces
+        std::string name, value;
+        size_t i = 1;
+        if (i < message.size() && message[i] == "name") i++;
+        for (; i < message.size() && message[i] != "value"; i++) name += (name.empty() ? "" : " ") + message[i];
+        for (i++; i < message.size(); i++) value += (value.empty() ? "" : " ") + message[i];
+
+        if (name == "Hash") {
+            size_t mb = std::strtoull(value.c_str(), nullptr, 10);
+            if (mb < 1 || mb > MAX_HASH_SIZE) uci::logMessage(_io, "Hash out of range");
+            else if (!_engine.setHashSize(mb)) {
+                uci::logMessage(_io, "Hash: can't allocate " + std::to_string(mb) + " MB, keeping " +
+                                std::to_string(_engine.config.hashSize) + " MB");
+            }
+        }
+        else if (name == "Threads") {
+            int count = std::atoi(value.c_str());
+            if (count < 1 || count > MAX_THREADS) uci::logMessage(_io, "Threads out of range");
+            else _engine.setThreadCount(count);
+        }
+        else if (name == "EvalFile" && !value.empty() && value != "<empty>") {
+            std::string error;
+            if (!_engine.loadNetwork(value, error)) uci::logMessage(_io, "EvalFile: " + error);
+            else uci::logMessage(_io, "EvalFile: loaded " + value + ", " + nnue::simdName(nnue::activeSimd()) + " kernels");
+        }
+        else if (name == "UseNNUE") {
+            _engine.setUseNetwork(value == "true");
+            if (value == "true" && !_engine.usingNetwork()) uci::logMessage(_io, "UseNNUE: no EvalFile loaded, using the classical eval");
+        }
     }
     else if (message[0] == "position"){
-        if (message[1] == "startpos") _engine.restart();
-        if (message[2] == "moves") {
+        // position (startpos | fen <fields>) [moves <move>...]
+        size_t moves = std::find(message.begin(), message.end(), "moves") - message.begin();
+        if (message.size() > 1 && message[1] == "startpos") _engine.restart();
+        else if (message.size() > 1 && message[1] == "fen") {
+            std::string fen;
+            for (size_t i = 2; i < moves; i++) fen += (fen.empty() ? "" : " ") + message[i];
+            Board board;
+            fen::ParseResult res = fen::fen_to_board(board, fen);
+            if (!res) {
+                uci::logMessage(_io, std::string("Invalid fen supplied by GUI: ") + res.error);
+                return;
+            }
+            _engine.setBoard(board);
+        }
+        if (moves < message.size()) {
             uint16_t from;
             uint16_t to;
-            for (size_t i = 3; i < message.size(); i++){
-                if (!uci::parseMove(message[i], from, to)) {
+            PieceType promotion;
+            for (size_t i = moves + 1; i < message.size(); i++){
+                if (!uci::parseMove(message[i], from, to, promotion)) {
                     uci::logMessage(_io,"Invalid move position supplied by GUI");
                     break;
                 }
 
+                // GUI squares are absolute, the board is relative to the side to move
+                bool white = _engine.getState().is_white;
+                from = relativeSquare(white, from);
+                to = relativeSquare(white, to);
+
                 PieceType t;
                 if ((t = getPieceTypeAtCell(_engine.getState(), from)) == PieceType::NONE) {
                     uci::logMessage(_io, "GUI state and engine state out of sync. Quitting");
                     _isRunning = false;
                     break;
                 }
-                _engine.makeMove({t,from,to});
+                _engine.makeMove({t,from,to,promotion});
             }
             // morphy::printBoard(_engine.getState(), _io.logstream());
         }
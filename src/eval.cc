@@ -0,0 +1,289 @@
+#include <morphy/eval.h>
+
+#include <algorithm>
+
+using namespace morphy;
+
+using Table = std::array<int16_t,64>;
+
+// Tables are written from white's side with a8 first, the way a board
+// is printed. They are flipped to a1 first when the sums are built.
+// https://www.chessprogramming.org/Simplified_Evaluation_Function
+static constexpr Table pawn_mg {{
+      0,   0,   0,   0,   0,   0,   0,   0,
+     50,  50,  50,  50,  50,  50,  50,  50,
+     10,  10,  20,  30,  30,  20,  10,  10,
+      5,   5,  10,  25,  25,  10,   5,   5,
+      0,   0,   0,  20,  20,   0,   0,   0,
+      5,  -5, -10,   0,   0, -10,  -5,   5,
+      5,  10,  10, -20, -20,  10,  10,   5,
+      0,   0,   0,   0,   0,   0,   0,   0
+}};
+
+static constexpr Table pawn_eg {{
+      0,   0,   0,   0,   0,   0,   0,   0,
+     80,  80,  80,  80,  80,  80,  80,  80,
+     50,  50,  50,  50,  50,  50,  50,  50,
+     30,  30,  30,  30,  30,  30,  30,  30,
+     15,  15,  15,  15,  15,  15,  15,  15,
+      5,   5,   5,   5,   5,   5,   5,   5,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0
+}};
+
+static constexpr Table knight_psq {{
+    -50, -40, -30, -30, -30, -30, -40, -50,
+    -40, -20,   0,   0,   0,   0, -20, -40,
+    -30,   0,  10,  15,  15,  10,   0, -30,
+    -30,   5,  15,  20,  20,  15,   5, -30,
+    -30,   0,  15,  20,  20,  15,   0, -30,
+    -30,   5,  10,  15,  15,  10,   5, -30,
+    -40, -20,   0,   5,   5,   0, -20, -40,
+    -50, -40, -30, -30, -30, -30, -40, -50
+}};
+
+static constexpr Table bishop_psq {{
+    -20, -10, -10, -10, -10, -10, -10, -20,
+    -10,   0,   0,   0,   0,   0,   0, -10,
+    -10,   0,   5,  10,  10,   5,   0, -10,
+    -10,   5,   5,  10,  10,   5,   5, -10,
+    -10,   0,  10,  10,  10,  10,   0, -10,
+    -10,  10,  10,  10,  10,  10,  10, -10,
+    -10,   5,   0,   0,   0,   0,   5, -10,
+    -20, -10, -10, -10, -10, -10, -10, -20
+}};
+
+static constexpr Table rook_psq {{
+      0,   0,   0,   0,   0,   0,   0,   0,
+      5,  10,  10,  10,  10,  10,  10,   5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+     -5,   0,   0,   0,   0,   0,   0,  -5,
+      0,   0,   0,   5,   5,   0,   0,   0
+}};
+
+static constexpr Table queen_psq {{
+    -20, -10, -10,  -5,  -5, -10, -10, -20,
+    -10,   0,   0,   0,   0,   0,   0, -10,
+    -10,   0,   5,   5,   5,   5,   0, -10,
+     -5,   0,   5,   5,   5,   5,   0,  -5,
+      0,   0,   5,   5,   5,   5,   0,  -5,
+    -10,   5,   5,   5,   5,   5,   0, -10,
+    -10,   0,   5,   0,   0,   0,   0, -10,
+    -20, -10, -10,  -5,  -5, -10, -10, -20
+}};
+
+static constexpr Table king_mg {{
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -20, -30, -30, -40, -40, -30, -30, -20,
+    -10, -20, -20, -20, -20, -20, -20, -10,
+     20,  20,   0,   0,   0,   0,  20,  20,
+     20,  30,  10,   0,   0,  10,  30,  20
+}};
+
+static constexpr Table king_eg {{
+    -50, -40, -30, -20, -20, -30, -40, -50,
+    -30, -20, -10,   0,   0, -10, -20, -30,
+    -30, -10,  20,  30,  30,  20, -10, -30,
+    -30, -10,  30,  40,  40,  30, -10, -30,
+    -30, -10,  30,  40,  40,  30, -10, -30,
+    -30, -10,  20,  30,  30,  20, -10, -30,
+    -30, -30,   0,   0,   0,   0, -30, -30,
+    -50, -30, -30, -30, -30, -30, -30, -50
+}};
+
+// PieceType order: pawn, rook, bishop, knight, queen, king
+static constexpr std::array<int16_t,6> material_mg {{82, 477, 365, 337, 1025, 0}};
+static constexpr std::array<int16_t,6> material_eg {{94, 512, 297, 281, 936, 0}};
+
+static constexpr PieceSquareTable build_table (const std::array<const Table*,6>& tables, const std::array<int16_t,6>& material) {
+    PieceSquareTable res{};
+    for (int t = 0; t < 6; t++) {
+        for (int sq = 0; sq < 64; sq++) {
+            res[t][sq] = material[t] + (*tables[t])[sq ^ 56];
+        }
+    }
+    return res;
+}
+
+const PieceSquareTable morphy::pst_mg = build_table(
+    {{&pawn_mg, &rook_psq, &bishop_psq, &knight_psq, &queen_psq, &king_mg}}, material_mg);
+const PieceSquareTable morphy::pst_eg = build_table(
+    {{&pawn_eg, &rook_psq, &bishop_psq, &knight_psq, &queen_psq, &king_eg}}, material_eg);
+
+void morphy::refreshPieceSquare (Board& board) {
+    board.psq_mg = 0;
+    board.psq_eg = 0;
+    board.phase = 0;
+    uint64_t white = board.is_white ? board.current_bb : all_pieces(board) & ~board.current_bb;
+    for (int t = 0; t < 6; t++) {
+        PieceType type = static_cast<PieceType>(t);
+        uint64_t pieces = *getPieceBoard(board, type);
+        while (pieces) {
+            uint16_t rel = __builtin_ctzll(pieces);
+            pieces &= pieces - 1;
+            bool isWhite = (white >> rel) & 1;
+            // Board squares are relative to the side to move
+            uint16_t sq = relativeSquare(board.is_white, rel);
+            if (isWhite) {
+                board.psq_mg += pst_mg[t][sq];
+                board.psq_eg += pst_eg[t][sq];
+            }
+            else {
+                board.psq_mg -= pst_mg[t][sq ^ 56];
+                board.psq_eg -= pst_eg[t][sq ^ 56];
+            }
+            board.phase += phase_weight[t];
+        }
+    }
+}
+
+// Pawn structure weights, middlegame then endgame
+static const int PASSED_MG[8] = {0, 5, 10, 15, 25, 45, 70, 0};      // by rank from the owner's side
+static const int PASSED_EG[8] = {0, 10, 15, 25, 45, 75, 120, 0};
+static const int ISOLATED_MG = -10, ISOLATED_EG = -15;
+static const int DOUBLED_MG = -10, DOUBLED_EG = -25;
+static const int BACKWARD_MG = -8, BACKWARD_EG = -10;
+static const int SHIELD_NEAR = 12, SHIELD_FAR = 6;      // pawns one and two ranks ahead of the king
+
+static const uint64_t FILE_A = 0x0101010101010101ULL;
+static const uint64_t FILE_H = FILE_A << 7;
+static const uint64_t RANK_1 = 0xffULL;
+
+// Set-wise helpers for a side moving north
+// https://www.chessprogramming.org/Pawn_Fills
+static uint64_t north_fill (uint64_t b) {
+    b |= b << 8;
+    b |= b << 16;
+    return b | (b << 32);
+}
+
+static uint64_t south_fill (uint64_t b) {
+    b |= b >> 8;
+    b |= b >> 16;
+    return b | (b >> 32);
+}
+
+static uint64_t east_one (uint64_t b) { return (b << 1) & ~FILE_A; }
+static uint64_t west_one (uint64_t b) { return (b >> 1) & ~FILE_H; }
+
+// Bitboards are relative to the side to move, these are white's
+static uint64_t white_pieces (const Board& board) {
+    return board.is_white ? board.current_bb : all_pieces(board) & ~board.current_bb;
+}
+
+static uint64_t absolute (const Board& board, uint64_t bb) {
+    return board.is_white ? bb : __builtin_bswap64(bb);
+}
+
+// Terms for own pawns moving north against enemy pawns moving south
+static void pawn_terms (uint64_t own, uint64_t enemy, int& mg, int& eg) {
+    uint64_t enemyFront = south_fill(enemy) >> 8;
+    uint64_t contested = enemyFront | east_one(enemyFront) | west_one(enemyFront);
+    // The rear pawn of a doubled pair isn't passed
+    uint64_t passed = own & ~contested & ~(south_fill(own) >> 8);
+    for (int rank = 1; rank < 7; rank++) {
+        int count = __builtin_popcountll(passed & (RANK_1 << (8 * rank)));
+        mg += PASSED_MG[rank] * count;
+        eg += PASSED_EG[rank] * count;
+    }
+
+    uint64_t files = north_fill(own) | south_fill(own);
+    int isolated = __builtin_popcountll(own & ~(east_one(files) | west_one(files)));
+    mg += ISOLATED_MG * isolated;
+    eg += ISOLATED_EG * isolated;
+
+    int doubled = __builtin_popcountll(own & (north_fill(own) << 8));
+    mg += DOUBLED_MG * doubled;
+    eg += DOUBLED_EG * doubled;
+
+    // Stop square attacked by an enemy pawn and no own pawn able to defend it
+    // https://www.chessprogramming.org/Backward_Pawns_(Bitboards)
+    uint64_t attackSpans = north_fill(east_one(own << 8) | west_one(own << 8));
+    uint64_t enemyAttacks = east_one(enemy >> 8) | west_one(enemy >> 8);
+    int backward = __builtin_popcountll(((own << 8) & enemyAttacks & ~attackSpans) >> 8);
+    mg += BACKWARD_MG * backward;
+    eg += BACKWARD_EG * backward;
+}
+
+static int shield_score (uint64_t own, uint64_t king) {
+    uint64_t files = king | east_one(king) | west_one(king);
+    return SHIELD_NEAR * __builtin_popcountll(own & (files << 8))
+         + SHIELD_FAR * __builtin_popcountll(own & (files << 16));
+}
+
+void morphy::evaluatePawns (const Board& board, PawnEntry& entry) {
+    uint64_t white = white_pieces(board);
+    uint64_t wp = absolute(board, board.pawns & white);
+    uint64_t bp = absolute(board, board.pawns & ~white);
+
+    int wmg = 0, weg = 0, bmg = 0, beg = 0;
+    pawn_terms(wp, bp, wmg, weg);
+    // Black is scored mirrored, moving north like white
+    pawn_terms(__builtin_bswap64(bp), __builtin_bswap64(wp), bmg, beg);
+
+    entry.key = board.pawn_hash;
+    entry.mg = wmg - bmg;
+    entry.eg = weg - beg;
+    entry.kingSq = {{64, 64}};
+    entry.shield = {{0, 0}};
+}
+
+void morphy::evaluateShield (const Board& board, PawnEntry& entry) {
+    uint64_t white = white_pieces(board);
+    uint64_t wk = absolute(board, board.kings & white);
+    uint64_t bk = absolute(board, board.kings & ~white);
+    uint16_t wsq = wk ? __builtin_ctzll(wk) : 64;
+    uint16_t bsq = bk ? __builtin_ctzll(bk) : 64;
+    if (entry.kingSq[0] == wsq && entry.kingSq[1] == bsq) return;
+
+    uint64_t wp = absolute(board, board.pawns & white);
+    uint64_t bp = absolute(board, board.pawns & ~white);
+    entry.kingSq = {{wsq, bsq}};
+    entry.shield[0] = shield_score(wp, wk);
+    entry.shield[1] = shield_score(__builtin_bswap64(bp), __builtin_bswap64(bk));
+}
+
+PawnTable::PawnTable (size_t count) :
+    _entries(count)
+{}
+
+void PawnTable::clear () {
+    std::fill(_entries.begin(), _entries.end(), PawnEntry{});
+    probes = 0;
+    hits = 0;
+}
+
+const PawnEntry& PawnTable::probe (const Board& board) {
+    probes++;
+    PawnEntry& entry = _entries[board.pawn_hash & (_entries.size() - 1)];
+    // A fresh entry has key 0, which is also right for a board without pawns
+    if (entry.key == board.pawn_hash) hits++;
+    else evaluatePawns(board, entry);
+    evaluateShield(board, entry);
+    return entry;
+}
+
+static int tapered_with_pawns (const Board& board, const PawnEntry& pawns) {
+    int phase = board.phase < PHASE_MAX ? board.phase : PHASE_MAX;
+    int mg = board.psq_mg + pawns.mg + pawns.shield[0] - pawns.shield[1];
+    int eg = board.psq_eg + pawns.eg;
+    int score = (mg * phase + eg * (PHASE_MAX - phase)) / PHASE_MAX;
+    return board.is_white ? score : -score;
+}
+
+int morphy::classicalEval (const Board& board, PawnTable& pawns) {
+    return tapered_with_pawns(board, pawns.probe(board));
+}
+
+int morphy::classicalEval (const Board& board) {
+    PawnEntry entry;
+    evaluatePawns(board, entry);
+    evaluateShield(board, entry);
+    return tapered_with_pawns(board, entry);
+}
@@ -1,57 +1,255 @@
 #include <morphy/fen.h>
-#include <sstream>
-#include <string>
-#include <map>
+#include <morphy/eval.h>
+
+#include <array>
+#include <charconv>
 
 namespace morphy {
 namespace fen {
 
-static const std::map<char,PieceType> _FEN2PIECE = {
-    {'p', PieceType::PAWN},
-    {'q', PieceType::QUEEN},
-    {'r', PieceType::ROOK},
-    {'b', PieceType::BISHOP},
-    {'k', PieceType::KING},
-    {'n', PieceType::KNIGHT},
-    {'-', PieceType::PAWN}
-};
-
-bool fen_to_board (Board &board, const std::string& fen) {
-    std::stringstream ss(fen);
-    std::string rank_str;
-
-    uint64_t white_bb = 0;
-    uint8_t rank = 7;
-    uint8_t file = 0;
-
-    // Parse the piece placement ranks
-    while (std::getline(ss, rank_str, '/')) {
-        for (char c : rank_str) {
-            if (c == ' ') break; // Skip spaces
-            if (isdigit(c)) {
-                file += (c - '0');
-                continue;
-            }
+static const uint64_t FILE_A = 0x0101010101010101ULL;
+static const uint64_t FILE_H = FILE_A << 7;
+static const uint64_t BACK_RANKS = 0xff000000000000ffULL;
+static const uint8_t BLACK = 8;     // added to the PieceType index of black pieces
+
+// Piece letter to PieceType index, plus BLACK for black. -1 if it isn't one.
+static constexpr std::array<int8_t,128> make_piece_codes () {
+    std::array<int8_t,128> codes{};
+    for (auto& c : codes) c = -1;
+    const char letters[] = "PRBNQK";
+    for (int t = 0; t < 6; t++) {
+        codes[letters[t]] = t;
+        codes[letters[t] - 'A' + 'a'] = t | BLACK;
+    }
+    return codes;
+}
+
+static constexpr std::array<int8_t,128> piece_codes = make_piece_codes();
+static const char piece_letters[2][7] = {"PRBNQK", "prbnqk"};
+
+static ParseResult fail (const char* error, size_t offset) {
+    return {error, offset};
+}
+
+// The next space separated field starting at pos, pos is left after it
+static std::string_view next_field (std::string_view fen, size_t& pos) {
+    while (pos < fen.size() && fen[pos] == ' ') pos++;
+    size_t start = pos;
+    while (pos < fen.size() && fen[pos] != ' ') pos++;
+    return fen.substr(start, pos - start);
+}
+
+// Where field starts in fen, errors in a field point at its first char
+static size_t field_offset (std::string_view fen, std::string_view field) {
+    return field.data() - fen.data();
+}
+
+template <class T>
+static bool parse_number (std::string_view field, T& value) {
+    auto res = std::from_chars(field.data(), field.data() + field.size(), value);
+    return res.ec == std::errc() && res.ptr == field.data() + field.size();
+}
+
+ParseResult fen_to_board (Board& board, std::string_view fen) {
+    // Placement, built straight into absolute bitboards
+    std::array<uint64_t,6> pieces{};
+    uint64_t white = 0;
+    int rank = 7;
+    int file = 0;
+    size_t pos = 0;
+    while (pos < fen.size() && fen[pos] == ' ') pos++;
+    for (; pos < fen.size() && fen[pos] != ' '; pos++) {
+        unsigned char c = fen[pos];
+        if (c == '/') {
+            if (file != 8 || rank == 0) return fail("rank doesn't have eight squares", pos);
+            rank--;
+            file = 0;
+        }
+        else if (c >= '1' && c <= '8') {
+            file += c - '0';
+            if (file > 8) return fail("rank doesn't have eight squares", pos);
+        }
+        else if (c == '0' || c == '9') {
+            return fail("empty square count isn't 1 to 8", pos);
+        }
+        else {
+            int code = c < piece_codes.size() ? piece_codes[c] : -1;
+            if (code < 0) return fail("unknown piece letter", pos);
+            if (file > 7) return fail("rank doesn't have eight squares", pos);
+            uint64_t bit = static_cast<uint64_t>(1) << (rank * 8 + file);
+            pieces[code & ~BLACK] |= bit;
+            if (!(code & BLACK)) white |= bit;
+            file++;
+        }
+    }
+    if (rank != 0 || file != 8) return fail("placement doesn't have eight ranks", pos);
+
+    uint64_t kings = pieces[static_cast<int>(PieceType::KING)];
+    uint64_t pawns = pieces[static_cast<int>(PieceType::PAWN)];
+    if (__builtin_popcountll(kings & white) != 1 || __builtin_popcountll(kings & ~white) != 1) {
+        return fail("each side needs one king", 0);
+    }
+    if (pawns & BACK_RANKS) return fail("pawn on the first or last rank", 0);
+
+    std::string_view side = next_field(fen, pos);
+    size_t start = field_offset(fen, side);
+    if (side != "w" && side != "b") return fail("side to move isn't w or b", start);
+    bool whiteToMove = side == "w";
+
+    std::string_view castling = next_field(fen, pos);
+    start = field_offset(fen, castling);
+    uint8_t castle[2] = {NO_CASTLE, NO_CASTLE};
+    if (castling.empty()) return fail("missing castling field", start);
+    if (castling != "-") {
+        for (size_t i = 0; i < castling.size(); i++) {
+            char c = castling[i];
+            if (c == 'K') castle[0] |= CASTLE_KINGSIDE;
+            else if (c == 'Q') castle[0] |= CASTLE_QUEENSIDE;
+            else if (c == 'k') castle[1] |= CASTLE_KINGSIDE;
+            else if (c == 'q') castle[1] |= CASTLE_QUEENSIDE;
+            else return fail("unknown castling right", start + i);
+        }
+    }
+    // Only keep rights whose king and rook are still at home
+    uint64_t rooks = pieces[static_cast<int>(PieceType::ROOK)];
+    uint64_t sides[2] = {white, ~white};
+    for (int s = 0; s < 2; s++) {
+        int home = s == 0 ? 0 : 56;
+        uint64_t ownRooks = rooks & sides[s];
+        if (!((kings & sides[s]) >> (home + 4) & 1)) castle[s] = NO_CASTLE;
+        if (!(ownRooks >> (home + 7) & 1)) castle[s] &= ~CASTLE_KINGSIDE;
+        if (!(ownRooks >> home & 1)) castle[s] &= ~CASTLE_QUEENSIDE;
+    }
+
+    std::string_view enPassant = next_field(fen, pos);
+    start = field_offset(fen, enPassant);
+    uint16_t epSq = 0;
+    if (enPassant.empty()) return fail("missing en passant field", start);
+    if (enPassant != "-") {
+        char epRank = whiteToMove ? '6' : '3';
+        if (enPassant.size() != 2 || enPassant[0] < 'a' || enPassant[0] > 'h' || enPassant[1] != epRank) {
+            return fail("bad en passant square", start);
+        }
+        epSq = (enPassant[1] - '1') * 8 + (enPassant[0] - 'a');
+        // The pawn that moved and one that can take it
+        uint64_t bit = static_cast<uint64_t>(1) << epSq;
+        uint64_t moved = whiteToMove ? (bit >> 8) & pawns & ~white : (bit << 8) & pawns & white;
+        uint64_t takers = whiteToMove
+            ? (((bit >> 9) & ~FILE_H) | ((bit >> 7) & ~FILE_A)) & pawns & white
+            : (((bit << 7) & ~FILE_H) | ((bit << 9) & ~FILE_A)) & pawns & ~white;
+        if (!moved || !takers) epSq = 0;
+    }
+
+    // The clocks are optional, EPD doesn't have them
+    uint16_t halfmove = 0;
+    uint16_t fullmove = 1;
+    size_t end = pos;
+    std::string_view field = next_field(fen, pos);
+    if (!field.empty() && parse_number(field, halfmove)) {
+        end = pos;
+        field = next_field(fen, pos);
+        if (!field.empty() && parse_number(field, fullmove)) end = pos;
+        else if (!field.empty() && field[0] >= '0' && field[0] <= '9') return fail("bad fullmove number", field_offset(fen, field));
+    }
+    else if (!field.empty() && field[0] >= '0' && field[0] <= '9') return fail("bad halfmove clock", field_offset(fen, field));
 
-            // printf("%c\n", c);
+    board = Board{};
+    board.pawns = pawns;
+    board.rooks = rooks;
+    board.bishops = pieces[static_cast<int>(PieceType::BISHOP)];
+    board.knights = pieces[static_cast<int>(PieceType::KNIGHT)];
+    board.queens = pieces[static_cast<int>(PieceType::QUEEN)];
+    board.kings = kings;
+    board.current_bb = white;
+    board.is_white = true;
+    board.current_castle_flags = castle[0];
+    board.other_castle_flags = castle[1];
+    board.en_passant_sq = epSq;
+    board.halfmove_clock = halfmove;
+    board.fullmove_number = fullmove;
+    // The board is always stored relative to the side to move
+    if (!whiteToMove) flipBoard(board);
+    board.hash = zobristHash(board);
+    board.pawn_hash = zobristPawnHash(board);
+    refreshPieceSquare(board);
+    return {nullptr, end};
+}
+
+template <class T>
+static size_t write_number (T value, char* out) {
+    return std::to_chars(out, out + 5, value).ptr - out;
+}
+
+size_t board_to_fen (const Board& board, char* out) {
+    // Absolute square contents, 0 for empty
+    std::array<char,64> squares{};
+    uint64_t white = board.is_white ? board.current_bb : all_pieces(board) & ~board.current_bb;
+    for (int t = 0; t < 6; t++) {
+        uint64_t bb = *getPieceBoard(board, static_cast<PieceType>(t));
+        for (; bb; bb &= bb - 1) {
+            uint16_t sq = __builtin_ctzll(bb);
+            squares[relativeSquare(board.is_white, sq)] = piece_letters[(white >> sq) & 1 ? 0 : 1][t];
+        }
+    }
 
-            PieceType pt = _FEN2PIECE.at(tolower(c));
-            bool is_white = true;
-            uint8_t curank = rank;
-            if (islower(c)) {
-                is_white = false;
-                curank = 7 - curank; // TODO: Rework board API so this isnt necessary
+    size_t n = 0;
+    for (int rank = 7; rank >= 0; rank--) {
+        int empty = 0;
+        for (int file = 0; file < 8; file++) {
+            char c = squares[rank * 8 + file];
+            if (!c) {
+                empty++;
+                continue;
             }
-            morphy::setBoardColor(board, is_white);
-            morphy::setPiece(board, pt, {file, curank});
-            file += 1;
+            if (empty) out[n++] = '0' + empty;
+            empty = 0;
+            out[n++] = c;
         }
-        rank -= 1;
-        file = 0;
+        if (empty) out[n++] = '0' + empty;
+        if (rank) out[n++] = '/';
     }
-    // TODO: Handle castling
-    morphy::setBoardColor(board, true);
-    return true;
+
+    out[n++] = ' ';
+    out[n++] = board.is_white ? 'w' : 'b';
+
+    out[n++] = ' ';
+    uint8_t whiteCastle = board.is_white ? board.current_castle_flags : board.other_castle_flags;
+    uint8_t blackCastle = board.is_white ? board.other_castle_flags : board.current_castle_flags;
+    size_t castleStart = n;
+    if (whiteCastle & CASTLE_KINGSIDE) out[n++] = 'K';
+    if (whiteCastle & CASTLE_QUEENSIDE) out[n++] = 'Q';
+    if (blackCastle & CASTLE_KINGSIDE) out[n++] = 'k';
+    if (blackCastle & CASTLE_QUEENSIDE) out[n++] = 'q';
+    if (n == castleStart) out[n++] = '-';
+
+    out[n++] = ' ';
+    if (board.en_passant_sq) {
+        uint16_t sq = relativeSquare(board.is_white, board.en_passant_sq);
+        out[n++] = 'a' + sq % 8;
+        out[n++] = '1' + sq / 8;
+    }
+    else {
+        out[n++] = '-';
+    }
+
+    out[n++] = ' ';
+    n += write_number(board.halfmove_clock, out + n);
+    out[n++] = ' ';
+    n += write_number(board.fullmove_number, out + n);
+    return n;
 }
 
-}} // end namespace
\ No newline at end of file
+std::string board_to_fen (const Board& board) {
+    char buffer[MAX_FEN_LENGTH];
+    return std::string(buffer, board_to_fen(board, buffer));
+}
+
+}} // end namespace
+
+std::string morphy::boardToFEN (const Board& board) {
+    return fen::board_to_fen(board);
+}
+
+bool morphy::boardFromFEN (Board& board, const std::string& fen) {
+    return static_cast<bool>(fen::fen_to_board(board, fen));
+}
@@ -6,7 +6,9 @@
 #include <string>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <cstring>
 
+#include <morphy/bench.h>
 #include <morphy/engine.h>
 #include <morphy/uci.h>
 
@@ -14,13 +16,30 @@
 using namespace morphy;
 
 
-int main () {
-    //testMasks();
-    //std::istringstream input("position startpos moves a2a3 g8f6 h2h4 b8c6 e2e4 f6e4 f2f3 e4g3 h4h5 g3h1 d2d3 e7e5\n");
-    std::istringstream input("position startpos moves a2a3 g8f6 h2h4 b8c6\nisready\ngo movetime 1000\n");
+int main (int argc, char** argv) {
+    // morphy bench [hash] [threads] [depth]
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        std::vector<std::string> args(argv + 1, argv + argc);
+        BenchConfig bench = DEFAULT_BENCH_CONFIG;
+        if (!parseBench(args, bench)) {
+            std::cerr << "usage: morphy bench [hash] [threads] [depth]\n";
+            return 2;
+        }
+        runBench(bench, DEFAULT_ENGINE_CONFIG, std::cout);
+        return 0;
+    }
+
+    // morphy [--log FILE], the log records everything sent and received
+    std::string logPath;
+    if (argc == 3 && !strcmp(argv[1], "--log")) logPath = argv[2];
+    else if (argc > 1) {
+        std::cerr << "usage: morphy [--log FILE]\n"
+                  << "       morphy bench [hash] [threads] [depth]\n";
+        return 2;
+    }
+
     std::cout.setf(std::ios::unitbuf);
-    //uci::IOPipe io(std::cout, std::cin, "./log.txt");
-    uci::IOPipe io(std::cout, input, "./log.txt");
+    uci::IOPipe io(std::cout, std::cin, logPath);
 
     Engine engine;
     UCIAdaptor uciengine(engine,io);
@@ -28,7 +47,11 @@ int main () {
     std::vector<std::string> message;
     while (uciengine.isRunning()) {
         std::string line;
-        io.readLine(line);
+        if (!io.readLine(line)) {
+            // Out of input, let a pending go finish before exiting
+            uciengine.waitForSearch();
+            break;
+        }
         if (line.length() > 0) {
             uci::splitString(line,message, ' ');
             uciengine.handleUCIMessage(message);
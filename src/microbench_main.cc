@@ -0,0 +1,174 @@
+// Per-primitive timings over the bench positions. Every benchmark walks
+// the whole corpus once per iteration and reports items per second, so
+// a change in one primitive shows up on its own line. Results can be
+// kept with --benchmark_out=FILE --benchmark_out_format=json.
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <morphy/bench.h>
+#include <morphy/board.h>
+#include <morphy/engine.h>
+#include <morphy/fen.h>
+
+using namespace morphy;
+
+struct Position {
+    Board board;
+    MoveGenCache genState;
+    std::vector<Move> moves;    // legal moves
+};
+
+static std::vector<Position> load_corpus () {
+    std::vector<Position> corpus;
+    for (const char* fen : benchPositions()) {
+        Position pos;
+        fen::fen_to_board(pos.board, fen);
+        pos.genState = MoveGenCache(pos.board);
+        MoveGenCache legal(pos.board);
+        generateAllLegalMoves(legal, pos.board);
+        MoveList list;
+        serializeMoves(legal, pos.board, list);
+        for (PackedMove packed : list) pos.moves.push_back(unpackMove(pos.board, packed));
+        corpus.push_back(std::move(pos));
+    }
+    return corpus;
+}
+
+static const std::vector<Position>& corpus () {
+    static const std::vector<Position> positions = load_corpus();
+    return positions;
+}
+
+static void BM_GenerateMoveMask (benchmark::State& state) {
+    PieceType type = static_cast<PieceType>(state.range(0));
+    std::vector<Position> positions = corpus();
+    int64_t items = 0;
+    for (auto _ : state) {
+        for (Position& pos : positions) {
+            uint64_t pieces = *getPieceBoard(pos.board, type) & pos.board.current_bb;
+            for (; pieces; pieces &= pieces - 1) {
+                benchmark::DoNotOptimize(generateMoveMask(pos.genState, pos.board, Vec2(__builtin_ctzll(pieces)), type));
+                items++;
+            }
+        }
+    }
+    state.SetItemsProcessed(items);
+}
+BENCHMARK(BM_GenerateMoveMask)
+    ->ArgName("type")
+    ->DenseRange(static_cast<int>(PieceType::PAWN), static_cast<int>(PieceType::KING));
+
+static void BM_GenerateAllMoves (benchmark::State& state) {
+    const std::vector<Position>& positions = corpus();
+    for (auto _ : state) {
+        for (const Position& pos : positions) {
+            MoveGenCache genState(pos.board);
+            generateAllMoves(genState, pos.board);
+            benchmark::DoNotOptimize(genState.moveCount);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * positions.size());
+}
+BENCHMARK(BM_GenerateAllMoves);
+
+static void BM_GenerateAllLegalMoves (benchmark::State& state) {
+    const std::vector<Position>& positions = corpus();
+    for (auto _ : state) {
+        for (const Position& pos : positions) {
+            MoveGenCache genState(pos.board);
+            generateAllLegalMoves(genState, pos.board);
+            benchmark::DoNotOptimize(genState.moveCount);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * positions.size());
+}
+BENCHMARK(BM_GenerateAllLegalMoves);
+
+static void BM_ValidateMove (benchmark::State& state) {
+    const std::vector<Position>& positions = corpus();
+    int64_t items = 0;
+    for (auto _ : state) {
+        for (const Position& pos : positions) {
+            for (const Move& move : pos.moves) {
+                benchmark::DoNotOptimize(validateMove(pos.genState, pos.board, move));
+            }
+            items += pos.moves.size();
+        }
+    }
+    state.SetItemsProcessed(items);
+}
+BENCHMARK(BM_ValidateMove);
+
+static void BM_ApplyMove (benchmark::State& state) {
+    const std::vector<Position>& positions = corpus();
+    int64_t items = 0;
+    for (auto _ : state) {
+        for (const Position& pos : positions) {
+            for (const Move& move : pos.moves) {
+                Board board = pos.board;
+                applyMove(board, move);
+                benchmark::DoNotOptimize(board);
+            }
+            items += pos.moves.size();
+        }
+    }
+    state.SetItemsProcessed(items);
+}
+BENCHMARK(BM_ApplyMove);
+
+static void BM_ThreatsToCells (benchmark::State& state) {
+    const std::vector<Position>& positions = corpus();
+    for (auto _ : state) {
+        for (const Position& pos : positions) {
+            // The king and the squares it passes over when castling
+            uint16_t king = pos.genState.kingSq;
+            uint16_t west = king % 8 ? king - 1 : king;
+            uint16_t east = king % 8 != 7 ? king + 1 : king;
+            benchmark::DoNotOptimize(threatsToCells(pos.genState, pos.board, {Vec2(west), Vec2(king), Vec2(east)}));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * positions.size());
+}
+BENCHMARK(BM_ThreatsToCells);
+
+static void BM_FlipBoard (benchmark::State& state) {
+    std::vector<Position> positions = corpus();
+    for (auto _ : state) {
+        for (Position& pos : positions) {
+            flipBoard(pos.board);
+            benchmark::DoNotOptimize(pos.board);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * positions.size());
+}
+BENCHMARK(BM_FlipBoard);
+
+static void BM_ScorePieces (benchmark::State& state) {
+    const std::vector<Position>& positions = corpus();
+    for (auto _ : state) {
+        for (const Position& pos : positions) {
+            benchmark::DoNotOptimize(scorePieces(DEFAULT_ENGINE_CONFIG, pos.board, pos.board.current_bb));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * positions.size());
+}
+BENCHMARK(BM_ScorePieces);
+
+static void BM_ParseFEN (benchmark::State& state) {
+    std::span<const char* const> fens = benchPositions();
+    int64_t bytes = 0;
+    for (auto _ : state) {
+        for (const char* fen : fens) {
+            Board board;
+            benchmark::DoNotOptimize(fen::fen_to_board(board, fen));
+            benchmark::DoNotOptimize(board);
+            bytes += std::char_traits<char>::length(fen);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * fens.size());
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_ParseFEN);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,207 @@
+#include <morphy/movepick.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace morphy;
+
+void OrderingTables::clear () {
+    clearKillers();
+    for (auto& c : counters) c.fill(PackedMove{});
+    for (auto& side : history) for (auto& from : side) from.fill(0);
+}
+
+void OrderingTables::clearKillers () {
+    for (auto& k : killers) k.fill(PackedMove{});
+}
+
+int OrderingTables::historyScore (bool white, PackedMove move) const {
+    return history[white][move.from()][move.to()];
+}
+
+// Moves the entry towards +-HISTORY_MAX, slower the closer it gets, so
+// old statistics fade instead of saturating.
+// https://www.chessprogramming.org/History_Heuristic
+static void update_history (int16_t& entry, int bonus) {
+    entry += bonus - entry * std::abs(bonus) / HISTORY_MAX;
+}
+
+void OrderingTables::updateQuiet (const Board& board, const Move& prevMove, int ply, int depth,
+                                  PackedMove move, const PackedMove* tried, size_t triedCount) {
+    int bonus = std::min(depth * depth, 400);
+    bool white = board.is_white;
+    update_history(history[white][move.from()][move.to()], bonus);
+    for (size_t i = 0; i < triedCount; i++) {
+        if (tried[i] == move) continue;
+        update_history(history[white][tried[i].from()][tried[i].to()], -bonus);
+    }
+
+    if (ply < MAX_KILLER_PLY && !(killers[ply][0] == move)) {
+        killers[ply][1] = killers[ply][0];
+        killers[ply][0] = move;
+    }
+    if (prevMove.type != PieceType::NONE) {
+        counters[static_cast<uint8_t>(prevMove.type)][prevMove.to] = move;
+    }
+}
+
+MovePicker::MovePicker (const EngineConfig& config, const Board& board, MoveGenCache& genState,
+                        const OrderingTables& tables, int ply, PackedMove ttMove, bool capturesOnly) :
+    _config(config),
+    _board(board),
+    _genState(genState),
+    _tables(tables),
+    _ply(ply),
+    _capturesOnly(capturesOnly && !genState.checkers),
+    _stage(TT_MOVE),
+    _ttMove(ttMove)
+{
+    _refutations.fill(PackedMove{});
+    if (_capturesOnly) return;
+    if (ply < MAX_KILLER_PLY) {
+        _refutations[0] = tables.killers[ply][0];
+        _refutations[1] = tables.killers[ply][1];
+    }
+    const Move& prev = genState.prevMove;
+    if (prev.type != PieceType::NONE) {
+        _refutations[2] = tables.counters[static_cast<uint8_t>(prev.type)][prev.to];
+    }
+}
+
+// Moves from the tables were found in other positions, make sure they
+// are legal here and of the kind the current stage hands out.
+bool MovePicker::usable (PackedMove move, bool quiet) const {
+    if (move.data == 0) return false;
+    if (quiet && (move.isCapture() || move.isPromotion())) return false;
+    Move m = unpackMove(_board, move);
+    if (m.type == PieceType::NONE || !(packMove(_board, m) == move)) return false;
+    // The flags must fit the piece that is on the square now
+    if ((m.type == PieceType::PAWN && m.to >= 56) != move.isPromotion()) return false;
+    return validateMove(_genState, _board, m);
+}
+
+// A legal quiet move equal to a refutation was already handed out in
+// the refutation stages
+bool MovePicker::isRefutation (PackedMove move) const {
+    return move == _refutations[0] || move == _refutations[1] || move == _refutations[2];
+}
+
+// Selection sort step, cheaper than sorting when a cutoff comes early
+size_t MovePicker::pickBest () {
+    size_t best = _current;
+    for (size_t i = _current + 1; i < _moves.size(); i++) {
+        if (_scores[i] > _scores[best]) best = i;
+    }
+    std::swap(_moves[_current], _moves[best]);
+    std::swap(_scores[_current], _scores[best]);
+    return _current++;
+}
+
+bool MovePicker::next (PackedMove& packed, Move& move) {
+    switch (_stage) {
+    case TT_MOVE:
+        _stage = GEN_CAPTURES;
+        if (usable(_ttMove, false)) {
+            packed = _ttMove;
+            move = unpackMove(_board, packed);
+            return true;
+        }
+        [[fallthrough]];
+
+    case GEN_CAPTURES: {
+        _genState.moves.clear();
+        generateAllCaptures(_genState, _board);
+        serializeMoves(_genState, _board, _moves);
+        for (size_t i = 0; i < _moves.size(); i++) {
+            PackedMove pm = _moves[i];
+            PieceType attacker = getPieceTypeAtCell(_board, pm.from());
+            PieceType victim = pm.flags() == EN_PASSANT ? PieceType::PAWN : getPieceTypeAtCell(_board, pm.to());
+            int value = victim == PieceType::NONE ? 0 : _config.pieceValue(victim);
+            // Most valuable victim, then least valuable attacker
+            _scores[i] = 10 * value - _config.pieceValue(attacker);
+            if (pm.isPromotion()) _scores[i] += 10 * _config.pieceValue(unpackMove(_board, pm).promotion);
+        }
+        _current = 0;
+        _stage = GOOD_CAPTURES;
+    }
+        [[fallthrough]];
+
+    case GOOD_CAPTURES:
+        while (_current < _moves.size()) {
+            size_t i = pickBest();
+            if (_moves[i] == _ttMove) continue;
+            move = unpackMove(_board, _moves[i]);
+            // Under-promotions are only worth a look with the quiets
+            if (_moves[i].isPromotion() && move.promotion != PieceType::QUEEN) {
+                if (!_capturesOnly) _badCaptures.push_back(_moves[i]);
+                continue;
+            }
+            if (_moves[i].isCapture() && staticExchange(_config, _board, move) < 0) {
+                _badCaptures.push_back(_moves[i]);
+                continue;
+            }
+            packed = _moves[i];
+            return true;
+        }
+        if (_capturesOnly) {
+            _stage = DONE;
+            return false;
+        }
+        _stage = KILLER_1;
+        [[fallthrough]];
+
+    case KILLER_1:
+    case KILLER_2:
+    case COUNTER_MOVE:
+        while (_stage <= COUNTER_MOVE) {
+            PackedMove pm = _refutations[_stage - KILLER_1];
+            bool duplicate = pm == _ttMove;
+            for (int i = KILLER_1; i < _stage; i++) duplicate |= pm == _refutations[i - KILLER_1];
+            _stage = static_cast<Stage>(_stage + 1);
+            if (!duplicate && usable(pm, true)) {
+                packed = pm;
+                move = unpackMove(_board, packed);
+                return true;
+            }
+        }
+        [[fallthrough]];
+
+    case GEN_QUIETS: {
+        _genState.moves.clear();
+        generateAllQuiets(_genState, _board);
+        MoveList quiets;
+        serializeMoves(_genState, _board, quiets);
+        _moves.clear();
+        for (PackedMove pm : quiets) {
+            if (pm == _ttMove || isRefutation(pm)) continue;
+            _scores[_moves.size()] = _tables.historyScore(_board.is_white, pm);
+            _moves.push_back(pm);
+        }
+        _current = 0;
+        _stage = QUIETS;
+    }
+        [[fallthrough]];
+
+    case QUIETS:
+        if (_current < _moves.size()) {
+            packed = _moves[pickBest()];
+            move = unpackMove(_board, packed);
+            return true;
+        }
+        _stage = BAD_CAPTURES;
+        [[fallthrough]];
+
+    case BAD_CAPTURES:
+        if (_badCurrent < _badCaptures.size()) {
+            packed = _badCaptures[_badCurrent++];
+            move = unpackMove(_board, packed);
+            return true;
+        }
+        _stage = DONE;
+        [[fallthrough]];
+
+    case DONE:
+        return false;
+    }
+    return false;
+}
@@ -0,0 +1,279 @@
+#include <morphy/nnue.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NNUE_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace morphy;
+using namespace morphy::nnue;
+
+// Kernels work on runs of HIDDEN_ALIGN values. An update adds and
+// subtracts weight rows from src in one pass and writes dst, which may
+// be src.
+using UpdateKernel = void (*)(int16_t* dst, const int16_t* src,
+                              const int16_t* const* adds, int addCount,
+                              const int16_t* const* subs, int subCount, int n);
+// Clipped ReLU of both accumulator halves dotted with the output weights
+using ForwardKernel = int32_t (*)(const int16_t* us, const int16_t* them, const int16_t* weights, int n);
+
+static void update_scalar (int16_t* dst, const int16_t* src,
+                           const int16_t* const* adds, int addCount,
+                           const int16_t* const* subs, int subCount, int n) {
+    for (int i = 0; i < n; i++) {
+        int16_t v = src[i];
+        for (int a = 0; a < addCount; a++) v += adds[a][i];
+        for (int s = 0; s < subCount; s++) v -= subs[s][i];
+        dst[i] = v;
+    }
+}
+
+static int32_t forward_scalar (const int16_t* us, const int16_t* them, const int16_t* weights, int n) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++) sum += std::clamp<int32_t>(us[i], 0, QA) * weights[i];
+    for (int i = 0; i < n; i++) sum += std::clamp<int32_t>(them[i], 0, QA) * weights[n + i];
+    return sum;
+}
+
+#ifdef NNUE_X86
+__attribute__((target("sse4.1")))
+static void update_sse41 (int16_t* dst, const int16_t* src,
+                          const int16_t* const* adds, int addCount,
+                          const int16_t* const* subs, int subCount, int n) {
+    for (int i = 0; i < n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        for (int a = 0; a < addCount; a++) v = _mm_add_epi16(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(adds[a] + i)));
+        for (int s = 0; s < subCount; s++) v = _mm_sub_epi16(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(subs[s] + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+    }
+}
+
+__attribute__((target("sse4.1")))
+static __m128i crelu_dot_sse41 (__m128i sum, const int16_t* acc, const int16_t* weights, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i qa = _mm_set1_epi16(QA);
+    for (int i = 0; i < n; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+        x = _mm_min_epi16(_mm_max_epi16(x, zero), qa);
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(x, w));
+    }
+    return sum;
+}
+
+__attribute__((target("sse4.1")))
+static int32_t forward_sse41 (const int16_t* us, const int16_t* them, const int16_t* weights, int n) {
+    __m128i sum = crelu_dot_sse41(_mm_setzero_si128(), us, weights, n);
+    sum = crelu_dot_sse41(sum, them, weights + n, n);
+    return _mm_extract_epi32(sum, 0) + _mm_extract_epi32(sum, 1)
+         + _mm_extract_epi32(sum, 2) + _mm_extract_epi32(sum, 3);
+}
+
+__attribute__((target("avx2")))
+static void update_avx2 (int16_t* dst, const int16_t* src,
+                         const int16_t* const* adds, int addCount,
+                         const int16_t* const* subs, int subCount, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        for (int a = 0; a < addCount; a++) v = _mm256_add_epi16(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(adds[a] + i)));
+        for (int s = 0; s < subCount; s++) v = _mm256_sub_epi16(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(subs[s] + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), v);
+    }
+}
+
+__attribute__((target("avx2")))
+static __m256i crelu_dot_avx2 (__m256i sum, const int16_t* acc, const int16_t* weights, int n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i qa = _mm256_set1_epi16(QA);
+    for (int i = 0; i < n; i += 16) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+        x = _mm256_min_epi16(_mm256_max_epi16(x, zero), qa);
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(x, w));
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static int32_t forward_avx2 (const int16_t* us, const int16_t* them, const int16_t* weights, int n) {
+    __m256i sum = crelu_dot_avx2(_mm256_setzero_si256(), us, weights, n);
+    sum = crelu_dot_avx2(sum, them, weights + n, n);
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_hadd_epi32(half, half);
+    half = _mm_hadd_epi32(half, half);
+    return _mm_cvtsi128_si32(half);
+}
+#endif
+
+struct Kernels {
+    UpdateKernel update;
+    ForwardKernel forward;
+};
+
+static Kernels kernels_for (Simd simd) {
+    switch (simd) {
+#ifdef NNUE_X86
+    case Simd::AVX2: return {update_avx2, forward_avx2};
+    case Simd::SSE41: return {update_sse41, forward_sse41};
+#endif
+    default: return {update_scalar, forward_scalar};
+    }
+}
+
+Simd nnue::detectSimd () {
+#ifdef NNUE_X86
+    // Needed when called before the runtime's own constructors have run
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Simd::AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return Simd::SSE41;
+#endif
+    return Simd::SCALAR;
+}
+
+static Simd active_simd = detectSimd();
+static Kernels active_kernels = kernels_for(active_simd);
+
+Simd nnue::activeSimd () {
+    return active_simd;
+}
+
+void nnue::setSimd (Simd simd) {
+    active_simd = std::min(simd, detectSimd());
+    active_kernels = kernels_for(active_simd);
+}
+
+const char* nnue::simdName (Simd simd) {
+    switch (simd) {
+    case Simd::AVX2: return "avx2";
+    case Simd::SSE41: return "sse4.1";
+    default: return "scalar";
+    }
+}
+
+// perspective and color are 0 for white, sq is absolute
+static int feature_index (int perspective, int color, PieceType type, uint16_t sq) {
+    int side = color == perspective ? 0 : 1;
+    return (side * 6 + static_cast<int>(type)) * 64 + (perspective == 0 ? sq : sq ^ 56);
+}
+
+template <class T>
+static void read_values (const char*& cursor, std::vector<T>& dest, size_t count) {
+    dest.resize(count);
+    std::memcpy(dest.data(), cursor, count * sizeof(T));
+    cursor += count * sizeof(T);
+}
+
+bool nnue::loadNetwork (Network& net, const std::string& path, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = "can't open " + path;
+        return false;
+    }
+    std::vector<char> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+    const size_t header = 12;
+    uint32_t version = 0, hidden = 0;
+    if (data.size() < header || std::memcmp(data.data(), "MNUE", 4) != 0) {
+        error = path + " is not a network file";
+        return false;
+    }
+    // The file is little endian, as are the hosts we build for
+    std::memcpy(&version, data.data() + 4, 4);
+    std::memcpy(&hidden, data.data() + 8, 4);
+    if (version != FILE_VERSION) {
+        error = "unsupported network version " + std::to_string(version);
+        return false;
+    }
+    if (hidden == 0 || hidden > MAX_HIDDEN || hidden % HIDDEN_ALIGN != 0) {
+        error = "unsupported hidden size " + std::to_string(hidden);
+        return false;
+    }
+    size_t expected = header + (FEATURE_COUNT * hidden + hidden + 2 * hidden) * sizeof(int16_t) + sizeof(int32_t);
+    if (data.size() != expected) {
+        error = path + " has " + std::to_string(data.size()) + " bytes, expected " + std::to_string(expected);
+        return false;
+    }
+
+    Network loaded;
+    loaded.hidden = hidden;
+    const char* cursor = data.data() + header;
+    read_values(cursor, loaded.featureWeights, FEATURE_COUNT * hidden);
+    read_values(cursor, loaded.featureBias, hidden);
+    read_values(cursor, loaded.outputWeights, 2 * hidden);
+    std::memcpy(&loaded.outputBias, cursor, sizeof(int32_t));
+    net = std::move(loaded);
+    return true;
+}
+
+void nnue::refresh (const Network& net, const Board& board, Accumulator& acc) {
+    int own = board.is_white ? 0 : 1;
+    for (int p = 0; p < 2; p++) {
+        int16_t* values = acc.values[p].data();
+        std::copy_n(net.featureBias.begin(), net.hidden, values);
+        for (int t = 0; t < 6; t++) {
+            PieceType type = static_cast<PieceType>(t);
+            uint64_t bb = *getPieceBoard(board, type);
+            for (; bb; bb &= bb - 1) {
+                uint16_t sq = __builtin_ctzll(bb);
+                int color = (board.current_bb >> sq) & 1 ? own : own ^ 1;
+                const int16_t* row = &net.featureWeights[feature_index(p, color, type, relativeSquare(board.is_white, sq)) * net.hidden];
+                active_kernels.update(values, values, &row, 1, nullptr, 0, net.hidden);
+            }
+        }
+    }
+}
+
+void nnue::update (const Network& net, const Board& board, const Move& move,
+                   const Accumulator& src, Accumulator& dst) {
+    struct Feature {
+        int color;
+        PieceType type;
+        uint16_t sq;    // relative to board
+    };
+    int own = board.is_white ? 0 : 1;
+    Feature adds[2], subs[2];
+    int addCount = 0, subCount = 0;
+
+    subs[subCount++] = {own, move.type, move.from};
+    adds[addCount++] = {own, move.promotion != PieceType::NONE ? move.promotion : move.type, move.to};
+
+    uint64_t enemy = all_pieces(board) & ~board.current_bb;
+    if ((enemy >> move.to) & 1) {
+        subs[subCount++] = {own ^ 1, getPieceTypeAtCell(board, move.to), move.to};
+    }
+    else if (move.type == PieceType::PAWN && board.en_passant_sq != 0 && move.to == board.en_passant_sq) {
+        subs[subCount++] = {own ^ 1, PieceType::PAWN, static_cast<uint16_t>(move.to - 8)};
+    }
+    else if (move.type == PieceType::KING && move.from == 4 && (move.to == 6 || move.to == 2)) {
+        bool kingside = move.to == 6;
+        subs[subCount++] = {own, PieceType::ROOK, static_cast<uint16_t>(kingside ? 7 : 0)};
+        adds[addCount++] = {own, PieceType::ROOK, static_cast<uint16_t>(kingside ? 5 : 3)};
+    }
+
+    for (int p = 0; p < 2; p++) {
+        const int16_t* addRows[2];
+        const int16_t* subRows[2];
+        for (int i = 0; i < addCount; i++) {
+            int idx = feature_index(p, adds[i].color, adds[i].type, relativeSquare(board.is_white, adds[i].sq));
+            addRows[i] = &net.featureWeights[idx * net.hidden];
+        }
+        for (int i = 0; i < subCount; i++) {
+            int idx = feature_index(p, subs[i].color, subs[i].type, relativeSquare(board.is_white, subs[i].sq));
+            subRows[i] = &net.featureWeights[idx * net.hidden];
+        }
+        active_kernels.update(dst.values[p].data(), src.values[p].data(), addRows, addCount, subRows, subCount, net.hidden);
+    }
+}
+
+int nnue::evaluate (const Network& net, const Board& board, const Accumulator& acc) {
+    int us = board.is_white ? 0 : 1;
+    int64_t output = active_kernels.forward(acc.values[us].data(), acc.values[us ^ 1].data(),
+                                            net.outputWeights.data(), net.hidden);
+    output += net.outputBias;
+    return static_cast<int>(output * OUTPUT_SCALE / (QA * QB));
+}
@@ -0,0 +1,259 @@
+#include <morphy/perft.h>
+#include <morphy/fen.h>
+#include <morphy/uci.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace morphy;
+
+struct PerftPosition {
+    const char* fen;
+    std::vector<uint64_t> nodes; // indexed by depth - 1
+};
+
+// https://www.chessprogramming.org/Perft_Results
+static const std::vector<PerftPosition> reference_positions {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        {20, 400, 8902, 197281, 4865609, 119060324}},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        {48, 2039, 97862, 4085603, 193690690}},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        {14, 191, 2812, 43238, 674624, 11030083, 178633661}},
+    {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        {6, 264, 9467, 422333, 15833292}},
+    {"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+        {6, 264, 9467, 422333, 15833292}},
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        {44, 1486, 62379, 2103487, 89941194}},
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+        {46, 2079, 89890, 3894594, 164075551}},
+};
+
+static double elapsedSeconds (std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Lock-free table of subtree counts. The key is stored xor'd with the
+// data so a torn write from another thread just reads as a miss.
+// https://www.chessprogramming.org/Shared_Hash_Table#Lockless
+class PerftTable {
+private:
+    struct Entry {
+        std::atomic<uint64_t> check{0};
+        std::atomic<uint64_t> data{0};
+    };
+    std::vector<Entry> _entries;
+    uint64_t _mask;
+
+public:
+    PerftTable (size_t megabytes) {
+        size_t count = 1;
+        while (count * 2 * sizeof(Entry) <= megabytes * 1024 * 1024) count *= 2;
+        _entries = std::vector<Entry>(count);
+        _mask = count - 1;
+    }
+
+    bool probe (uint64_t key, int depth, uint64_t& nodes) const {
+        const Entry& e = _entries[key & _mask];
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        uint64_t check = e.check.load(std::memory_order_relaxed);
+        if ((check ^ data) != key || static_cast<int>(data & 0xff) != depth) return false;
+        nodes = data >> 8;
+        return true;
+    }
+
+    void store (uint64_t key, int depth, uint64_t nodes) {
+        Entry& e = _entries[key & _mask];
+        uint64_t data = (nodes << 8) | static_cast<uint64_t>(depth);
+        e.check.store(key ^ data, std::memory_order_relaxed);
+        e.data.store(data, std::memory_order_relaxed);
+    }
+};
+
+static uint64_t perft_hashed (Board& board, int depth, PerftTable& table) {
+    if (depth <= 1) return perft(board, depth);
+
+    uint64_t nodes = 0;
+    if (table.probe(board.hash, depth, nodes)) return nodes;
+
+    MoveGenCache genState{board};
+    generateAllLegalMoves(genState, board);
+    MoveList moves;
+    serializeMoves(genState, board, moves);
+
+    UndoRecord undo;
+    for (PackedMove pm : moves) {
+        Move move = unpackMove(board, pm);
+        makeMove(board, move, undo);
+        nodes += perft_hashed(board, depth - 1, table);
+        unmakeMove(board, move, undo);
+    }
+    table.store(board.hash, depth, nodes);
+    return nodes;
+}
+
+static void legalMoves (Board& board, std::vector<Move>& dest) {
+    MoveGenCache genState{board};
+    generateAllLegalMoves(genState, board);
+    MoveList moves;
+    serializeMoves(genState, board, moves);
+    for (PackedMove pm : moves) dest.emplace_back(unpackMove(board, pm));
+}
+
+// Counts under each root move. Every (root move, reply) pair is a task
+// so even 20 root moves keep a large machine busy.
+static std::vector<uint64_t> perft_split (Board& board, int depth, const PerftConfig& config, std::vector<Move>& rootMoves) {
+    struct Task {
+        size_t root;
+        Move reply;
+        uint64_t nodes;
+    };
+
+    legalMoves(board, rootMoves);
+    std::vector<uint64_t> counts(rootMoves.size(), 0);
+    if (depth <= 2) {
+        UndoRecord undo;
+        for (size_t i = 0; i < rootMoves.size(); i++) {
+            makeMove(board, rootMoves[i], undo);
+            counts[i] = perft(board, depth - 1);
+            unmakeMove(board, rootMoves[i], undo);
+        }
+        return counts;
+    }
+
+    std::vector<Task> tasks;
+    for (size_t i = 0; i < rootMoves.size(); i++) {
+        UndoRecord undo;
+        std::vector<Move> replies;
+        makeMove(board, rootMoves[i], undo);
+        legalMoves(board, replies);
+        unmakeMove(board, rootMoves[i], undo);
+        for (const Move& reply : replies) tasks.push_back({i, reply, 0});
+    }
+
+    PerftTable table(config.hashSize);
+    std::atomic<size_t> next{0};
+    auto worker = [&] () {
+        Board local = board;
+        size_t idx;
+        while ((idx = next.fetch_add(1, std::memory_order_relaxed)) < tasks.size()) {
+            Task& task = tasks[idx];
+            UndoRecord rootUndo, replyUndo;
+            makeMove(local, rootMoves[task.root], rootUndo);
+            makeMove(local, task.reply, replyUndo);
+            task.nodes = config.hashSize ? perft_hashed(local, depth - 2, table) : perft(local, depth - 2);
+            unmakeMove(local, task.reply, replyUndo);
+            unmakeMove(local, rootMoves[task.root], rootUndo);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < config.threadCount; i++) threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads) t.join();
+
+    for (const Task& task : tasks) counts[task.root] += task.nodes;
+    return counts;
+}
+
+uint64_t morphy::perft (Board& board, int depth, const PerftConfig& config) {
+    if (depth <= 0) return 1;
+    std::vector<Move> rootMoves;
+    uint64_t nodes = 0;
+    for (uint64_t count : perft_split(board, depth, config, rootMoves)) nodes += count;
+    return nodes;
+}
+
+uint64_t morphy::perftDivide (Board& board, int depth, const PerftConfig& config, std::ostream& out) {
+    if (depth <= 0) return 1;
+    std::vector<Move> rootMoves;
+    std::vector<uint64_t> counts = perft_split(board, depth, config, rootMoves);
+
+    uint64_t nodes = 0;
+    for (size_t i = 0; i < rootMoves.size(); i++) {
+        out << uci::moveToString(rootMoves[i], board.is_white) << ": " << counts[i] << "\n";
+        nodes += counts[i];
+    }
+    out << "\nMoves: " << rootMoves.size() << "\nNodes: " << nodes << "\n";
+    return nodes;
+}
+
+uint64_t morphy::perft (Board& board, int depth) {
+    if (depth <= 0) return 1;
+
+    MoveGenCache genState{board};
+    generateAllLegalMoves(genState, board);
+    if (depth == 1) return genState.moveCount;
+
+    MoveList moves;
+    serializeMoves(genState, board, moves);
+
+    uint64_t nodes = 0;
+    UndoRecord undo;
+    for (PackedMove pm : moves) {
+        Move move = unpackMove(board, pm);
+        makeMove(board, move, undo);
+        nodes += perft(board, depth - 1);
+        unmakeMove(board, move, undo);
+    }
+    return nodes;
+}
+
+uint64_t morphy::perftDivide (Board& board, int depth, std::ostream& out) {
+    if (depth <= 0) return 1;
+
+    MoveGenCache genState{board};
+    generateAllLegalMoves(genState, board);
+    MoveList moves;
+    serializeMoves(genState, board, moves);
+
+    uint64_t nodes = 0;
+    UndoRecord undo;
+    for (PackedMove pm : moves) {
+        Move move = unpackMove(board, pm);
+        bool white = board.is_white;
+        makeMove(board, move, undo);
+        uint64_t count = perft(board, depth - 1);
+        unmakeMove(board, move, undo);
+        out << uci::moveToString(move, white) << ": " << count << "\n";
+        nodes += count;
+    }
+    out << "\nMoves: " << moves.size() << "\nNodes: " << nodes << "\n";
+    return nodes;
+}
+
+bool morphy::runPerftSuite (int maxDepth, const PerftConfig& config, std::ostream& out) {
+    bool passed = true;
+    uint64_t totalNodes = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (const auto& pos : reference_positions) {
+        Board board;
+        if (!fen::fen_to_board(board, pos.fen)) {
+            out << "FAIL could not parse " << pos.fen << "\n";
+            passed = false;
+            continue;
+        }
+        out << pos.fen << "\n";
+        for (int depth = 1; depth <= maxDepth && depth <= static_cast<int>(pos.nodes.size()); depth++) {
+            auto posStart = std::chrono::steady_clock::now();
+            uint64_t nodes = perft(board, depth, config);
+            double secs = elapsedSeconds(posStart);
+            bool ok = nodes == pos.nodes[depth - 1];
+            passed = passed && ok;
+            totalNodes += nodes;
+            out << "  depth " << depth << " " << (ok ? "ok  " : "FAIL") << " " << nodes;
+            if (!ok) out << " expected " << pos.nodes[depth - 1];
+            out << " (" << static_cast<uint64_t>(nodes / std::max(secs, 1e-9)) << " nps)\n";
+        }
+    }
+
+    double secs = elapsedSeconds(start);
+    out << (passed ? "passed" : "FAILED") << ": " << totalNodes << " nodes in "
+        << secs << "s, " << static_cast<uint64_t>(totalNodes / std::max(secs, 1e-9)) << " nps\n";
+    return passed;
+}
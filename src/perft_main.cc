@@ -0,0 +1,57 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <morphy/board.h>
+#include <morphy/fen.h>
+#include <morphy/perft.h>
+
+using namespace morphy;
+
+static void usage () {
+    std::cerr << "usage: morphy_perft [--suite] [--depth N] [--fen FEN] [--divide] [--threads N] [--hash MB]\n"
+              << "  --suite   run the reference positions up to --depth (default 4)\n"
+              << "  --fen     position to count, defaults to the start position\n"
+              << "  --divide  print the node count under each root move\n"
+              << "  --threads worker threads (default 1)\n"
+              << "  --hash    shared subtree table in MB, 0 disables it (default 16)\n";
+}
+
+int main (int argc, char** argv) {
+    bool suite = false;
+    bool divide = false;
+    int depth = 4;
+    std::string fen;
+    PerftConfig config = DEFAULT_PERFT_CONFIG;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--suite")) suite = true;
+        else if (!strcmp(argv[i], "--divide")) divide = true;
+        else if (!strcmp(argv[i], "--depth") && i + 1 < argc) depth = std::stoi(argv[++i]);
+        else if (!strcmp(argv[i], "--fen") && i + 1 < argc) fen = argv[++i];
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) config.threadCount = std::stoi(argv[++i]);
+        else if (!strcmp(argv[i], "--hash") && i + 1 < argc) config.hashSize = std::stoul(argv[++i]);
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (suite) return runPerftSuite(depth, config, std::cout) ? 0 : 1;
+
+    Board board;
+    if (fen.empty()) initializeBoard(board);
+    else if (!fen::fen_to_board(board, fen)) {
+        std::cerr << "invalid fen: " << fen << "\n";
+        return 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t nodes = divide ? perftDivide(board, depth, config, std::cout) : perft(board, depth, config);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "depth " << depth << " nodes " << nodes << " time " << secs << "s nps "
+              << static_cast<uint64_t>(nodes / std::max(secs, 1e-9)) << "\n";
+    return 0;
+}
@@ -0,0 +1,473 @@
+#include <morphy/search.h>
+#include <morphy/timeman.h>
+#include <morphy/movepick.h>
+#include <morphy/eval.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+using namespace morphy;
+
+using Clock = std::chrono::steady_clock;
+
+// State shared by every thread of one search
+struct SharedSearch {
+    const EngineConfig& config;
+    const SearchLimits& limits;
+    TranspositionTable& tt;
+    std::atomic<bool>& stop;        // set by the caller
+    std::atomic<bool> done{false};  // set when the main thread is finished
+    Clock::time_point start;
+    std::unique_ptr<std::atomic<uint64_t>[]> nodes;     // published by each thread
+    int threadCount;
+
+    SharedSearch (const EngineConfig& config, const SearchLimits& limits, TranspositionTable& tt,
+                  std::atomic<bool>& stop, int threadCount) :
+        config(config), limits(limits), tt(tt), stop(stop), start(Clock::now()),
+        nodes(new std::atomic<uint64_t>[threadCount]), threadCount(threadCount)
+    {
+        for (int i = 0; i < threadCount; i++) nodes[i] = 0;
+    }
+
+    uint64_t totalNodes () const {
+        uint64_t total = 0;
+        for (int i = 0; i < threadCount; i++) total += nodes[i].load(std::memory_order_relaxed);
+        return total;
+    }
+};
+
+// Per thread search state, only the transposition table is shared
+struct SearchState {
+    SharedSearch& shared;
+    const EngineConfig& config;
+    TranspositionTable& tt;
+    int id;
+    Board board;
+    std::vector<uint64_t> hashes;   // positions before the current one
+    uint64_t nodes = 0;
+
+    OrderingTables& ordering;
+    PawnTable& pawns;
+    std::array<Move,MAX_PLY> stack;     // move played at each ply
+
+    // Triangular principal variation table
+    std::array<std::array<Move,MAX_PLY>,MAX_PLY> pv;
+    std::array<int,MAX_PLY> pvLength{};
+    std::vector<Move> prevPv;
+
+    // Network accumulators by ply, only kept when config.network is set
+    std::vector<nnue::Accumulator> accumulators;
+
+    SearchState (SharedSearch& shared, int id, ThreadTables& tables, const Board& board,
+                 const std::vector<uint64_t>& history) :
+        shared(shared), config(shared.config), tt(shared.tt), id(id), board(board), hashes(history),
+        ordering(tables.ordering), pawns(tables.pawns)
+    {
+        ordering.clearKillers();
+        if (config.network) {
+            accumulators.resize(MAX_PLY + 1);
+            nnue::refresh(*config.network, board, accumulators[0]);
+        }
+    }
+
+    bool stopped () const {
+        return shared.done.load(std::memory_order_relaxed) || shared.stop.load(std::memory_order_relaxed);
+    }
+};
+
+static uint64_t elapsedMs (const SharedSearch& shared) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - shared.start).count();
+}
+
+// Captures whose victim can't lift the eval this close to alpha are skipped
+static const int DELTA_MARGIN = 200;
+
+// Selectivity margins, in centipawns
+static const int RFP_MARGIN = 80;                               // per ply
+static const int FUTILITY_MARGIN[] = {0, 150, 300, 500};        // by depth
+static const int ASPIRATION_WINDOW = 25;
+
+// Nodes between clock and node budget checks, a power of two
+static const uint64_t CHECK_INTERVAL = 1024;
+
+// Only the main thread checks the budget, the others just follow the stop flag
+static void checkLimits (SearchState& s) {
+    s.shared.nodes[s.id].store(s.nodes, std::memory_order_relaxed);
+    if (s.id != 0) return;
+    const SearchLimits& limits = s.shared.limits;
+    if ((limits.nodes && s.shared.totalNodes() >= limits.nodes)
+     || (limits.hardTime && elapsedMs(s.shared) >= limits.hardTime)) {
+        s.shared.done.store(true, std::memory_order_relaxed);
+    }
+}
+
+static int evaluate (SearchState& s, int ply) {
+    if (!s.config.network) return classicalEval(s.board, s.pawns);
+    // A bad network mustn't produce mate scores
+    int score = nnue::evaluate(*s.config.network, s.board, s.accumulators[ply]);
+    return std::clamp(score, -SCORE_MATE_BOUND + 1, SCORE_MATE_BOUND - 1);
+}
+
+// makeMove, bringing the next ply's accumulator up to date. Unmaking
+// needs nothing as this ply's accumulator is left intact.
+static void playMove (SearchState& s, int ply, const Move& move, UndoRecord& undo) {
+    if (s.config.network) nnue::update(*s.config.network, s.board, move, s.accumulators[ply], s.accumulators[ply + 1]);
+    makeMove(s.board, move, undo);
+}
+
+static bool isRepetition (const SearchState& s) {
+    // Same side to move only, the hash includes the side
+    for (size_t i = s.hashes.size(); i >= 2; i -= 2) {
+        if (s.hashes[i - 2] == s.board.hash) return true;
+        if (s.hashes.size() - i > 100) break;
+    }
+    return false;
+}
+
+// Mate scores are stored relative to the node so they stay correct
+// when the position is reached at a different ply.
+static int scoreToTT (int score, int ply) {
+    if (score >= SCORE_MATE_BOUND) return score + ply;
+    if (score <= -SCORE_MATE_BOUND) return score - ply;
+    return score;
+}
+
+static int scoreFromTT (int score, int ply) {
+    if (score >= SCORE_MATE_BOUND) return score - ply;
+    if (score <= -SCORE_MATE_BOUND) return score + ply;
+    return score;
+}
+
+// Only captures and promotions are searched past the horizon, so the
+// static eval is never taken in the middle of an exchange. The side to
+// move may stand pat on the static eval unless in check, where every
+// evasion is searched.
+// https://www.chessprogramming.org/Quiescence_Search
+static int quiescence (SearchState& s, int ply, int alpha, int beta) {
+    s.pvLength[ply] = 0;
+    if ((++s.nodes & (CHECK_INTERVAL - 1)) == 0) checkLimits(s);
+    if (s.stopped()) return 0;
+    if (ply >= MAX_PLY - 1) return evaluate(s, ply);
+
+    MoveGenCache genState{s.board};
+    genState.prevMove = ply > 0 ? s.stack[ply - 1] : Move{PieceType::NONE, 0, 0};
+    bool inCheck = genState.checkers != 0;
+    int standPat = -SCORE_INFINITE;
+    if (!inCheck) {
+        standPat = evaluate(s, ply);
+        if (standPat >= beta) return standPat;
+        if (standPat > alpha) alpha = standPat;
+    }
+
+    MovePicker picker(s.config, s.board, genState, s.ordering, ply, PackedMove{}, true);
+    int best = standPat;
+    int moveCount = 0;
+    PackedMove packed;
+    Move move;
+    UndoRecord undo;
+    while (picker.next(packed, move)) {
+        moveCount++;
+        if (!inCheck && !packed.isPromotion()) {
+            // Delta pruning: even winning the piece for free can't reach alpha
+            int victim = packed.flags() == EN_PASSANT ? s.config.pieceValue(PieceType::PAWN)
+                       : s.config.pieceValue(getPieceTypeAtCell(s.board, move.to));
+            if (standPat + victim + DELTA_MARGIN <= alpha) continue;
+        }
+
+        s.stack[ply] = move;
+        playMove(s, ply, move, undo);
+        int score = -quiescence(s, ply + 1, -beta, -alpha);
+        unmakeMove(s.board, move, undo);
+        if (s.stopped()) break;
+
+        if (score > best) {
+            best = score;
+            if (score > alpha) {
+                alpha = score;
+                if (alpha >= beta) break;
+            }
+        }
+    }
+    if (inCheck && moveCount == 0) return -SCORE_MATE + ply;
+    return best;
+}
+
+static bool sideInCheck (const Board& board) {
+    uint64_t king = board.kings & board.current_bb;
+    if (!king) return false;
+    uint16_t sq = __builtin_ctzll(king);
+    return isSquareAttacked(board, sq, all_pieces(board));
+}
+
+// Pawn endings are where zugzwang is common and passing is unsound
+static bool hasNonPawnMaterial (const Board& board) {
+    return (board.knights | board.bishops | board.rooks | board.queens) & board.current_bb;
+}
+
+// Late move reduction in plies by [depth][move number]
+// https://www.chessprogramming.org/Late_Move_Reductions
+static const auto reductions = [] () {
+    std::array<std::array<int,64>,64> table{};
+    for (int d = 1; d < 64; d++) {
+        for (int m = 1; m < 64; m++) {
+            table[d][m] = static_cast<int>(0.75 + std::log(d) * std::log(m) / 2.25);
+        }
+    }
+    return table;
+}();
+
+static int negamax (SearchState& s, int depth, int ply, int alpha, int beta) {
+    s.pvLength[ply] = 0;
+    if ((++s.nodes & (CHECK_INTERVAL - 1)) == 0) checkLimits(s);
+    if (s.stopped()) return 0;
+    if (ply > 0 && isRepetition(s)) return 0;
+    if (depth <= 0 || ply >= MAX_PLY - 1) return quiescence(s, ply, alpha, beta);
+
+    const EngineConfig& config = s.config;
+    bool pvNode = beta - alpha > 1;
+
+    // The root always searches so it has a full PV to report
+    TTEntry entry;
+    PackedMove ttMove;
+    bool ttHit = s.tt.probe(s.board.hash, entry);
+    if (ttHit) {
+        ttMove = entry.move;
+        int score = scoreFromTT(entry.score, ply);
+        if (ply > 0 && !pvNode && entry.depth >= depth
+            && (entry.bound == Bound::EXACT
+             || (entry.bound == Bound::LOWER && score >= beta)
+             || (entry.bound == Bound::UPPER && score <= alpha))) {
+            return score;
+        }
+    }
+    // At the root the previous iteration's best move goes first, so a cut
+    // short iteration never ends with a worse move
+    if (ply == 0 && !s.prevPv.empty()) ttMove = packMove(s.board, s.prevPv[0]);
+
+    MoveGenCache genState{s.board};
+    genState.prevMove = ply > 0 ? s.stack[ply - 1] : Move{PieceType::NONE, 0, 0};
+    bool inCheck = genState.checkers != 0;
+
+    int eval = SCORE_NONE;
+    if (!inCheck) eval = ttHit && entry.eval != SCORE_NONE ? entry.eval : evaluate(s, ply);
+
+    // Reverse futility: far enough above beta that a shallow search
+    // won't bring the score back down
+    if (config.reverseFutilityPruning && !pvNode && !inCheck && depth <= 6
+        && eval - RFP_MARGIN * depth >= beta && std::abs(beta) < SCORE_MATE_BOUND) {
+        return eval;
+    }
+
+    // Null move: if passing still fails high a real move will too. Not
+    // twice in a row, and not without pieces where zugzwang is likely.
+    // https://www.chessprogramming.org/Null_Move_Pruning
+    if (config.nullMovePruning && !pvNode && !inCheck && depth >= 3 && eval >= beta
+        && ply > 0 && s.stack[ply - 1].type != PieceType::NONE && hasNonPawnMaterial(s.board)) {
+        int r = 3 + depth / 4;
+        UndoRecord undo;
+        s.stack[ply] = Move{PieceType::NONE, 0, 0};
+        s.hashes.push_back(s.board.hash);
+        if (config.network) s.accumulators[ply + 1] = s.accumulators[ply];
+        makeNullMove(s.board, undo);
+        int score = -negamax(s, depth - 1 - r, ply + 1, -beta, -beta + 1);
+        unmakeNullMove(s.board, undo);
+        s.hashes.pop_back();
+        if (s.stopped()) return 0;
+        // Don't trust a mate found by passing
+        if (score >= beta) return score >= SCORE_MATE_BOUND ? beta : score;
+    }
+
+    // Futility: quiet moves can't raise a hopeless eval by enough
+    bool futile = config.futilityPruning && !pvNode && !inCheck && depth < 4
+               && std::abs(alpha) < SCORE_MATE_BOUND && eval + FUTILITY_MARGIN[depth] <= alpha;
+
+    MovePicker picker(config, s.board, genState, s.ordering, ply, ttMove);
+
+    int origAlpha = alpha;
+    int best = -SCORE_INFINITE;
+    int moveCount = 0;
+    PackedMove bestMove;
+    MoveList quietsTried;
+    PackedMove packed;
+    Move move;
+    UndoRecord undo;
+    s.hashes.push_back(s.board.hash);
+    while (picker.next(packed, move)) {
+        moveCount++;
+        bool quiet = !packed.isCapture() && !packed.isPromotion();
+        s.stack[ply] = move;
+        playMove(s, ply, move, undo);
+        bool givesCheck = sideInCheck(s.board);
+
+        if (futile && quiet && !givesCheck && moveCount > 1) {
+            unmakeMove(s.board, move, undo);
+            continue;
+        }
+
+        // Principal variation search: the first move gets the full window,
+        // the rest a null window, reduced when they come late in the order
+        int score;
+        if (moveCount == 1) score = -negamax(s, depth - 1, ply + 1, -beta, -alpha);
+        else {
+            int r = 0;
+            if (config.lateMoveReductions && depth >= 3 && moveCount > 3 && quiet && !inCheck && !givesCheck) {
+                r = reductions[std::min(depth, 63)][std::min(moveCount, 63)];
+                if (pvNode) r--;
+                // Hash move and refutations
+                if (picker.stage() < MovePicker::QUIETS) r--;
+                r = std::clamp(r, 0, depth - 2);
+            }
+            score = -negamax(s, depth - 1 - r, ply + 1, -alpha - 1, -alpha);
+            if (score > alpha && r > 0) score = -negamax(s, depth - 1, ply + 1, -alpha - 1, -alpha);
+            if (score > alpha && score < beta) score = -negamax(s, depth - 1, ply + 1, -beta, -alpha);
+        }
+        unmakeMove(s.board, move, undo);
+        if (s.stopped()) break;
+
+        if (score > best) {
+            best = score;
+            bestMove = packed;
+            if (score > alpha) {
+                alpha = score;
+                s.pv[ply][0] = move;
+                std::copy_n(s.pv[ply + 1].begin(), s.pvLength[ply + 1], s.pv[ply].begin() + 1);
+                s.pvLength[ply] = s.pvLength[ply + 1] + 1;
+                if (alpha >= beta) {
+                    if (quiet) {
+                        s.ordering.updateQuiet(s.board, genState.prevMove, ply, depth, packed,
+                                               quietsTried.begin(), quietsTried.size());
+                    }
+                    break;
+                }
+            }
+        }
+        if (quiet) quietsTried.push_back(packed);
+    }
+    s.hashes.pop_back();
+    if (moveCount == 0 && !s.stopped()) return inCheck ? -SCORE_MATE + ply : 0;
+    if (s.stopped()) return best;
+
+    Bound bound = best >= beta ? Bound::LOWER : best > origAlpha ? Bound::EXACT : Bound::UPPER;
+    s.tt.store(s.board.hash, depth, scoreToTT(best, ply), eval, bound, bestMove);
+    return best;
+}
+
+// Searches the root in a narrow window around the last score, widening
+// it on the side that failed until the score falls inside.
+// https://www.chessprogramming.org/Aspiration_Windows
+static int aspirationSearch (SearchState& s, int depth, int prevScore) {
+    if (!s.config.aspirationWindows || depth < 5 || std::abs(prevScore) >= SCORE_MATE_BOUND) {
+        return negamax(s, depth, 0, -SCORE_INFINITE, SCORE_INFINITE);
+    }
+    int delta = ASPIRATION_WINDOW;
+    int alpha = std::max(prevScore - delta, -SCORE_INFINITE);
+    int beta = std::min(prevScore + delta, SCORE_INFINITE);
+    while (true) {
+        int score = negamax(s, depth, 0, alpha, beta);
+        if (s.stopped()) return score;
+        if (score <= alpha) alpha = std::max(score - delta, -SCORE_INFINITE);
+        else if (score >= beta) beta = std::min(score + delta, SCORE_INFINITE);
+        else return score;
+        delta *= 2;
+    }
+}
+
+// Lazy SMP helpers skip some depths so the threads spread over
+// different iterations instead of all searching the same tree.
+// https://www.chessprogramming.org/Lazy_SMP
+static const int SKIP_SIZE[] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+static const int SKIP_PHASE[] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+static bool skipDepth (int id, int depth) {
+    if (id == 0) return false;
+    int i = (id - 1) % 20;
+    return ((depth + SKIP_PHASE[i]) / SKIP_SIZE[i]) % 2;
+}
+
+// Iterative deepening loop run by every thread. Only the main thread
+// (result != nullptr) reports iterations.
+static void iterate (SearchState& s, int maxDepth, Move& best, MoveGenState* result, const SearchCallback& onIteration) {
+    TimeManager time(s.shared.limits);
+    int score = 0;
+    for (int depth = 1; depth <= maxDepth; depth++) {
+        if (skipDepth(s.id, depth)) continue;
+        score = aspirationSearch(s, depth, score);
+        // A partial iteration still searched the previous best move first,
+        // so its best move is at least as good as the last one.
+        if (s.pvLength[0] > 0) best = s.pv[0][0];
+        if (s.stopped()) break;
+
+        s.prevPv.assign(s.pv[0].begin(), s.pv[0].begin() + s.pvLength[0]);
+        if (result) {
+            result->depth = depth;
+            result->score = score;
+            result->nodes = s.shared.totalNodes() + s.nodes - s.shared.nodes[s.id];
+            result->searchTime = elapsedMs(s.shared);
+            result->currentMove = best;
+            result->bestPath = s.prevPv;
+            if (onIteration) onIteration(*result);
+
+            time.update(best, score);
+            if (time.softExpired(result->searchTime)) break;
+        }
+
+        // Found a forced mate within the searched depth
+        if (std::abs(score) >= SCORE_MATE_BOUND && SCORE_MATE - std::abs(score) <= depth) break;
+    }
+    s.shared.nodes[s.id].store(s.nodes, std::memory_order_relaxed);
+}
+
+void ThreadTables::clear () {
+    ordering.clear();
+    pawns.clear();
+}
+
+Move morphy::searchBestMove (const EngineConfig& config, const SearchLimits& limits, Board& state,
+                             TranspositionTable& tt, std::vector<std::unique_ptr<ThreadTables>>& threads,
+                             const std::vector<uint64_t>& history, std::atomic<bool>& stop, MoveGenState& result, const SearchCallback& onIteration) {
+    result = MoveGenState{};
+    result.bestPath.clear();
+
+    // Always have a legal move to return, even if depth 1 is cut short
+    MoveGenCache genState{state};
+    generateAllLegalMoves(genState, state);
+    MoveList moves;
+    serializeMoves(genState, state, moves);
+    if (moves.empty()) {
+        // Mated or stalemated, there's nothing to search
+        if (genState.checkers) result.score = -SCORE_MATE;
+        return Move{PieceType::NONE, 0, 0};
+    }
+    Move best = unpackMove(state, moves[0]);
+
+    int threadCount = std::clamp(config.theadCount, 1, MAX_THREADS);
+    int maxDepth = std::min({limits.depth, config.searchDepth, MAX_PLY - 1});
+    SharedSearch shared(config, limits, tt, stop, threadCount);
+    tt.newSearch();
+
+    while (threads.size() < static_cast<size_t>(threadCount)) threads.emplace_back(new ThreadTables());
+    std::vector<std::unique_ptr<SearchState>> states;
+    for (int i = 0; i < threadCount; i++) {
+        states.emplace_back(new SearchState(shared, i, *threads[i], state, history));
+    }
+
+    std::vector<std::thread> helpers;
+    for (int i = 1; i < threadCount; i++) {
+        helpers.emplace_back([&, i, move = best] () mutable {
+            iterate(*states[i], maxDepth, move, nullptr, nullptr);
+        });
+    }
+    iterate(*states[0], maxDepth, best, &result, onIteration);
+
+    shared.done.store(true, std::memory_order_relaxed);
+    for (std::thread& t : helpers) t.join();
+
+    result.nodes = shared.totalNodes();
+    result.searchTime = elapsedMs(shared);
+    if (result.bestPath.empty()) result.bestPath.push_back(best);
+    return best;
+}
@@ -0,0 +1,60 @@
+#include <morphy/timeman.h>
+#include <morphy/search.h>
+
+#include <algorithm>
+
+using namespace morphy;
+
+SearchLimits morphy::allocateTime (const uci::GoCommand& go, bool white, int maxDepth) {
+    SearchLimits limits{maxDepth, 0, 0, 0};
+    if (go.depth > 0) limits.depth = std::min(go.depth, maxDepth);
+    if (go.nodes > 0) limits.nodes = go.nodes;
+    if (go.infinite) return limits;
+
+    if (go.movetime >= 0) {
+        uint64_t t = std::max<int64_t>(go.movetime - static_cast<int64_t>(MOVE_OVERHEAD), 1);
+        limits.softTime = t;
+        limits.hardTime = t;
+        return limits;
+    }
+
+    int64_t time = white ? go.wtime : go.btime;
+    int64_t inc = white ? go.winc : go.binc;
+    if (time < 0) return limits;
+
+    // Never plan on more than what is left after the overhead
+    uint64_t available = std::max<int64_t>(time - static_cast<int64_t>(MOVE_OVERHEAD), 1);
+    int movesToGo = go.movestogo > 0 ? std::min(go.movestogo, 50) : DEFAULT_MOVES_TO_GO;
+    uint64_t soft = available / movesToGo + std::max<int64_t>(inc, 0) * 3 / 4;
+    // Keep a reserve even when the time control ends with this move
+    uint64_t hard = std::min(soft * 4, available * 3 / 4);
+
+    limits.hardTime = std::max<uint64_t>(std::min(hard, available), 1);
+    limits.softTime = std::max<uint64_t>(std::min(soft, limits.hardTime), 1);
+    return limits;
+}
+
+TimeManager::TimeManager (const SearchLimits& limits) :
+    _soft(limits.softTime),
+    _hard(limits.hardTime),
+    _lastScore(0)
+{}
+
+void TimeManager::update (const Move& best, int score) {
+    // Changes decay so only recent ones keep the search going
+    _instability *= 0.5;
+    if (_iterations > 0 && (best.from != _lastBest.from || best.to != _lastBest.to)) _instability += 1;
+
+    _drop = _iterations > 0 ? std::clamp(_lastScore - score, 0, 200) : 0;
+    _lastBest = best;
+    _lastScore = score;
+    _iterations++;
+}
+
+bool TimeManager::softExpired (uint64_t elapsedMs) const {
+    if (_soft == 0) return false;
+    double scale = (1.0 + _instability * 0.6) * (1.0 + _drop / 200.0);
+    uint64_t deadline = static_cast<uint64_t>(_soft * std::min(scale, 3.0));
+    if (_hard) deadline = std::min(deadline, _hard);
+    return elapsedMs >= deadline;
+}
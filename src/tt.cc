@@ -0,0 +1,108 @@
+#include <morphy/tt.h>
+
+using namespace morphy;
+
+// Data layout: move (16) | score (16) | eval (16) | depth (8) | bound (2) | generation (6)
+static constexpr uint64_t GENERATION_MASK = 0x3f;
+
+static uint64_t pack_entry (PackedMove move, int score, int eval, int depth, Bound bound, uint8_t generation) {
+    return static_cast<uint64_t>(move.data) |
+           static_cast<uint64_t>(static_cast<uint16_t>(score)) << 16 |
+           static_cast<uint64_t>(static_cast<uint16_t>(eval)) << 32 |
+           static_cast<uint64_t>(depth & 0xff) << 48 |
+           static_cast<uint64_t>(bound) << 56 |
+           static_cast<uint64_t>(generation & GENERATION_MASK) << 58;
+}
+
+static TTEntry unpack_entry (uint64_t data) {
+    TTEntry entry;
+    entry.move.data = static_cast<uint16_t>(data);
+    entry.score = static_cast<int16_t>(data >> 16);
+    entry.eval = static_cast<int16_t>(data >> 32);
+    entry.depth = static_cast<uint8_t>(data >> 48);
+    entry.bound = static_cast<Bound>((data >> 56) & 3);
+    return entry;
+}
+
+static int entry_depth (uint64_t data) { return static_cast<uint8_t>(data >> 48); }
+static uint8_t entry_generation (uint64_t data) { return (data >> 58) & GENERATION_MASK; }
+
+TranspositionTable::TranspositionTable (size_t megabytes) {
+    resize(megabytes);
+}
+
+void TranspositionTable::resize (size_t megabytes) {
+    size_t count = megabytes * 1024 * 1024 / sizeof(Bucket);
+    if (count == 0) count = 1;
+    if (count != _count) {
+        // Allocated before the old table goes so a failure leaves it intact
+        std::unique_ptr<Bucket[]> buckets(new Bucket[count]);
+        _buckets = std::move(buckets);
+        _count = count;
+    }
+    clear();
+}
+
+void TranspositionTable::clear () {
+    for (size_t i = 0; i < _count; i++) {
+        for (Entry& e : _buckets[i].entries) {
+            e.check.store(0, std::memory_order_relaxed);
+            e.data.store(0, std::memory_order_relaxed);
+        }
+    }
+    _generation = 0;
+}
+
+size_t TranspositionTable::size () const {
+    return _count * sizeof(Bucket) / (1024 * 1024);
+}
+
+void TranspositionTable::newSearch () {
+    _generation = (_generation + 1) & GENERATION_MASK;
+}
+
+// Maps the key onto any table size without a modulo.
+// https://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/
+TranspositionTable::Bucket& TranspositionTable::bucketFor (uint64_t key) const {
+    return _buckets[static_cast<uint64_t>((static_cast<unsigned __int128>(key) * _count) >> 64)];
+}
+
+bool TranspositionTable::probe (uint64_t key, TTEntry& entry) const {
+    for (const Entry& e : bucketFor(key).entries) {
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        uint64_t check = e.check.load(std::memory_order_relaxed);
+        if ((check ^ data) == key && data != 0) {
+            entry = unpack_entry(data);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TranspositionTable::store (uint64_t key, int depth, int score, int eval, Bound bound, PackedMove move) {
+    Bucket& bucket = bucketFor(key);
+    Entry* replace = &bucket.entries[0];
+    int worst = 1 << 30;
+    for (Entry& e : bucket.entries) {
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        uint64_t check = e.check.load(std::memory_order_relaxed);
+        if ((check ^ data) == key) {
+            // Keep the old best move and deeper results for the same position
+            if (move.data == 0) move = unpack_entry(data).move;
+            if (bound != Bound::EXACT && depth + 2 < entry_depth(data)
+                && entry_generation(data) == _generation) return;
+            replace = &e;
+            break;
+        }
+        // Prefer the shallowest entry, older searches count as shallower
+        int age = (_generation - entry_generation(data)) & GENERATION_MASK;
+        int value = data == 0 ? -(1 << 30) : entry_depth(data) - 8 * age;
+        if (value < worst) {
+            worst = value;
+            replace = &e;
+        }
+    }
+    uint64_t data = pack_entry(move, score, eval, depth, bound, _generation);
+    replace->check.store(key ^ data, std::memory_order_relaxed);
+    replace->data.store(data, std::memory_order_relaxed);
+}
@@ -1,4 +1,5 @@
 #include <morphy/uci.h>
+#include <morphy/score.h>
 
 using namespace morphy::uci;
 
@@ -17,6 +18,33 @@ void morphy::uci::splitString (const std::string& str, std::vector<std::string>&
     }
 }
 
+bool morphy::uci::parseGo (const std::vector<std::string>& message, GoCommand& go) {
+    go = GoCommand{};
+    try {
+        for (size_t i = 1; i < message.size(); i++) {
+            const std::string& key = message[i];
+            if (key == "infinite") { go.infinite = true; continue; }
+            if (key == "ponder") continue;
+            if (key == "searchmoves") break;
+            if (i + 1 >= message.size()) return false;
+            const std::string& value = message[++i];
+            if (key == "wtime") go.wtime = std::stoll(value);
+            else if (key == "btime") go.btime = std::stoll(value);
+            else if (key == "winc") go.winc = std::stoll(value);
+            else if (key == "binc") go.binc = std::stoll(value);
+            else if (key == "movestogo") go.movestogo = std::stoi(value);
+            else if (key == "movetime") go.movetime = std::stoll(value);
+            else if (key == "depth") go.depth = std::stoi(value);
+            else if (key == "nodes") go.nodes = std::stoull(value);
+            else if (key != "mate") return false;
+        }
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
 bool morphy::uci::parseMove (const std::string& str, uint16_t& from, uint16_t& to) {
     if (str.length() != 4) return false;
     uint16_t fx = str[0] - 97;
@@ -30,6 +58,21 @@ bool morphy::uci::parseMove (const std::string& str, uint16_t& from, uint16_t& t
     return true;
 }
 
+bool morphy::uci::parseMove (const std::string& str, uint16_t& from, uint16_t& to, PieceType& promotion) {
+    promotion = PieceType::NONE;
+    if (str.length() == 5) {
+        switch (str[4]) {
+        case 'q': promotion = PieceType::QUEEN; break;
+        case 'r': promotion = PieceType::ROOK; break;
+        case 'b': promotion = PieceType::BISHOP; break;
+        case 'n': promotion = PieceType::KNIGHT; break;
+        default: return false;
+        }
+        return parseMove(str.substr(0,4), from, to);
+    }
+    return parseMove(str, from, to);
+}
+
 
 void morphy::uci::setSpinOption (std::ostream& stream, const std::string& name, const size_t def, const size_t min, const size_t max) {
     stream << "option name " << name << " type spin "
@@ -52,7 +95,7 @@ void morphy::uci::setCheckOption (std::ostream& stream, const std::string& name,
 }
 
 void morphy::uci::setStringOption (std::ostream& stream, const std::string& name, const std::string& value) {
-    stream << "option name " << name << " type text " << "default " << value << "\n";
+    stream << "option name " << name << " type string " << "default " << value << "\n";
 }
 
 
@@ -71,6 +114,17 @@ UCIConfigurator& UCIConfigurator::setHashRange (size_t min, size_t max, size_t d
     return *this;
 }
 
+UCIConfigurator& UCIConfigurator::setThreadRange (size_t min, size_t max, size_t def) {
+    setSpinOption(_stream, "Threads", def, min, max);
+    return *this;
+}
+
+UCIConfigurator& UCIConfigurator::setEvalFile (const std::string& path, bool enabled) {
+    setCheckOption(_stream, "UseNNUE", enabled);
+    setStringOption(_stream, "EvalFile", path.empty() ? "<empty>" : path);
+    return *this;
+}
+
 UCIConfigurator& UCIConfigurator::setNalimovTableBase (const std::string& path, size_t min, size_t max) {
     setStringOption(_stream, "NamilovPath", path);
     setSpinOption(_stream, "NamilovCache", min, max, min);
@@ -127,13 +181,22 @@ void morphy::uci::signalReady (std::ostream& stream) {
     stream << "readyok\n";
 }
 
-static std::string moveToString (const morphy::Move& move) {
+std::string morphy::uci::moveToString (const Move& move, bool white) {
     std::stringstream stream;
-    char fx = static_cast<char>((move.from % 8)+97);
-    uint16_t fy = move.from / 8 + 1;
-    char tx = static_cast<char>((move.to % 8)+97);
-    uint16_t ty = move.to / 8 + 1;
+    uint16_t from = relativeSquare(white, move.from);
+    uint16_t to = relativeSquare(white, move.to);
+    char fx = static_cast<char>((from % 8)+97);
+    uint16_t fy = from / 8 + 1;
+    char tx = static_cast<char>((to % 8)+97);
+    uint16_t ty = to / 8 + 1;
     stream << fx << fy << tx << ty;
+    switch (move.promotion) {
+    case morphy::PieceType::QUEEN:  stream << 'q'; break;
+    case morphy::PieceType::ROOK:   stream << 'r'; break;
+    case morphy::PieceType::BISHOP: stream << 'b'; break;
+    case morphy::PieceType::KNIGHT: stream << 'n'; break;
+    default: break;
+    }
     return stream.str();
 
 }
@@ -150,7 +213,21 @@ void morphy::uci::logMessage (std::ostream& stream, const std::string& message)
     stream << "info string " << message << "\n";
 }
 
-//void morphy::uci::moveGenInfo (std::stringstream& stream, const MoveGenState& gen) {
-//}
+void morphy::uci::moveGenInfo (std::ostream& stream, const MoveGenState& gen, bool white) {
+    stream << "info depth " << gen.depth << " score ";
+    if (gen.score >= SCORE_MATE_BOUND) stream << "mate " << (SCORE_MATE - gen.score + 1) / 2;
+    else if (gen.score <= -SCORE_MATE_BOUND) stream << "mate " << -((SCORE_MATE + gen.score) / 2);
+    else stream << "cp " << gen.score;
+    stream << " nodes " << gen.nodes << " time " << gen.searchTime;
+    if (gen.searchTime > 0) stream << " nps " << gen.nodes * 1000 / gen.searchTime;
+    if (!gen.bestPath.empty()) {
+        stream << " pv";
+        for (const Move& m : gen.bestPath) {
+            stream << " " << moveToString(m, white);
+            white = !white;
+        }
+    }
+    stream << "\n";
+}
 
 